@@ -14,9 +14,10 @@
 #include <gmp.h>
 #include <gmpxx.h>
 #include <random>
-#include <chrono>   // Included but not used in the library functions.
-#include <limits>   // Required for std::numeric_limits.
+#include <cstring>   // Required for std::memcpy.
+#include <algorithm> // Required for std::min.
 #include "SHE.h"
+#include "parallel.h"
 
 /**
  * @brief  Constructor for the SecretKey class.
@@ -29,39 +30,175 @@ SecretKey::SecretKey(const mpz_class& p, const mpz_class& q, const mpz_class& L)
     this->N = this->p * this->q;
 }
 
+// --- Scheme Parameters ---
+// The bit length of the noise r (k2). generateRandom(80) used to mask its result
+// down to 80 % 64 = 16 bits, and the multiplicative depth of the range test
+// (2 x 7 Bloom probes under a 2048-bit p) is sized for that width.
+static const int k2_bits = 16;
+// The bit length of r' in the mask (1 + r'*p) (k0).
+static const int k0_bits = 4096;
+
 /**
- * @brief  Generates a random mpz_class integer of a specified bit length.
- * @note   This uses std::mt19937_64 for pseudo-randomness, which is suitable
- *         for general purposes but might not be sufficient for production-grade
- *         cryptography, where a hardware-based or OS-level entropy source is preferred.
- * @param  k  The desired bit length of the random number.
- * @return An mpz_class integer containing k random bits.
+ * @brief  Rotates a 32-bit word left.
  */
-mpz_class generateRandom(int k) {
-    // Use std::random_device to seed the pseudo-random number generator for better entropy.
+static inline uint32_t rotl32(uint32_t x, int n) {
+    return (x << n) | (x >> (32 - n));
+}
+
+/**
+ * @brief  The ChaCha quarter round on four words of the state.
+ */
+static inline void quarter_round(uint32_t *x, int a, int b, int c, int d) {
+    x[a] += x[b]; x[d] = rotl32(x[d] ^ x[a], 16);
+    x[c] += x[d]; x[b] = rotl32(x[b] ^ x[c], 12);
+    x[a] += x[b]; x[d] = rotl32(x[d] ^ x[a], 8);
+    x[c] += x[d]; x[b] = rotl32(x[b] ^ x[c], 7);
+}
+
+/**
+ * @brief  Seeds a new stream with a 256-bit key and a 64-bit nonce from std::random_device.
+ */
+RandomStream::RandomStream() : position(sizeof(buffer)) {
     std::random_device rd;
-    std::mt19937_64 gen(rd());
-    std::uniform_int_distribution<uint64_t> dis(0, std::numeric_limits<uint64_t>::max());
 
-    int num_bits = k;
-    int num_words = (num_bits + 63) / 64; // Calculate how many 64-bit chunks are needed.
-    mpz_class r = 0;
+    // "expand 32-byte k"
+    state[0] = 0x61707865;
+    state[1] = 0x3320646e;
+    state[2] = 0x79622d32;
+    state[3] = 0x6b206574;
+    for (int i = 4; i < 12; ++i) {
+        state[i] = rd();
+    }
+    state[12] = 0; // 64-bit block counter
+    state[13] = 0;
+    state[14] = rd();
+    state[15] = rd();
+}
 
-    // Build the large random number by concatenating 64-bit random words.
-    for (int i = 0; i < num_words; ++i) {
-        mpz_class word = dis(gen);
-        r = (r << 64) | word;
+/**
+ * @brief  Produces the next batch of keystream blocks into the buffer.
+ */
+void RandomStream::refill() {
+    for (size_t block = 0; block < sizeof(buffer) / 64; ++block) {
+        uint32_t x[16];
+        std::memcpy(x, state, sizeof(x));
+        for (int i = 0; i < 10; ++i) {
+            quarter_round(x, 0, 4, 8, 12);
+            quarter_round(x, 1, 5, 9, 13);
+            quarter_round(x, 2, 6, 10, 14);
+            quarter_round(x, 3, 7, 11, 15);
+            quarter_round(x, 0, 5, 10, 15);
+            quarter_round(x, 1, 6, 11, 12);
+            quarter_round(x, 2, 7, 8, 13);
+            quarter_round(x, 3, 4, 9, 14);
+        }
+        for (int i = 0; i < 16; ++i) {
+            uint32_t word = x[i] + state[i];
+            std::memcpy(buffer + block * 64 + i * 4, &word, sizeof(word));
+        }
+        // Advance the block counter.
+        if (++state[12] == 0) {
+            ++state[13];
+        }
     }
+    position = 0;
+}
+
+/**
+ * @brief  Copies the next `count` bytes of keystream into `out`.
+ * @param  out    The destination buffer.
+ * @param  count  The number of bytes to produce.
+ */
+void RandomStream::fill_bytes(uint8_t *out, size_t count) {
+    while (count > 0) {
+        if (position == sizeof(buffer)) {
+            refill();
+        }
+        size_t n = std::min(count, sizeof(buffer) - position);
+        std::memcpy(out, buffer + position, n);
+        // Keystream bytes are handed out once; wipe them from the buffer.
+        std::memset(buffer + position, 0, n);
+        position += n;
+        out += n;
+        count -= n;
+    }
+}
+
+/**
+ * @brief  Sets `out` to a uniformly random integer of at most k bits.
+ * @param  out  The destination integer.
+ * @param  k    The bit length.
+ */
+void RandomStream::next(mpz_class& out, int k) {
+    if (k <= 0) {
+        out = 0;
+        return;
+    }
+    size_t num_bytes = (static_cast<size_t>(k) + 7) / 8;
+    bytes.resize(num_bytes);
+    fill_bytes(bytes.data(), num_bytes);
+
+    // The bytes are imported most significant first, so the excess high bits
+    // live in the first byte.
+    int excess = static_cast<int>(num_bytes * 8 - k);
+    bytes[0] &= static_cast<uint8_t>(0xff >> excess);
+    mpz_import(out.get_mpz_t(), num_bytes, 1, 1, 1, 0, bytes.data());
+}
 
-    // Ensure the random number is strictly within the desired bit length by masking
-    // off any excess bits in the most significant word.
-    if (num_bits % 64 != 0) {
-        mpz_class mask = (mpz_class(1) << (num_bits % 64)) - 1;
-        r &= mask;
+/**
+ * @brief  Fills a range of integers with independent k-bit random values.
+ * @param  out    The first destination integer.
+ * @param  count  The number of integers to fill.
+ * @param  k      The bit length of each value.
+ */
+void RandomStream::next(mpz_class *out, size_t count, int k) {
+    for (size_t i = 0; i < count; ++i) {
+        next(out[i], k);
     }
+}
+
+/**
+ * @brief  Returns the calling thread's stream, seeding it on first use.
+ */
+RandomStream& RandomStream::thread_instance() {
+    thread_local RandomStream stream;
+    return stream;
+}
+
+/**
+ * @brief  Returns the next 64 bits of keystream.
+ */
+RandomStream::result_type RandomStream::operator()() {
+    result_type value;
+    fill_bytes(reinterpret_cast<uint8_t *>(&value), sizeof(value));
+    return value;
+}
+
+/**
+ * @brief  Generates a random mpz_class integer of a specified bit length.
+ * @note   Draws from the calling thread's ChaCha20 keystream, which is seeded
+ *         once per thread from std::random_device.
+ * @param  k  The desired bit length of the random number.
+ * @return An mpz_class integer containing k random bits.
+ */
+mpz_class generateRandom(int k) {
+    mpz_class r;
+    RandomStream::thread_instance().next(r, k);
     return r;
 }
 
+/**
+ * @brief  Generates many random integers of a specified bit length in one call.
+ * @param  k      The desired bit length of each random number.
+ * @param  count  The number of values to generate.
+ * @return A vector of `count` integers, each containing k random bits.
+ */
+std::vector<mpz_class> generateRandomBatch(int k, size_t count) {
+    std::vector<mpz_class> values(count);
+    RandomStream::thread_instance().next(values.data(), count, k);
+    return values;
+}
+
 /**
  * @brief  Encrypts a plaintext message 'm'.
  * @note   The encryption formula is: c = ((r*L + m) * (1 + r'*p)) mod N
@@ -73,8 +210,8 @@ mpz_class generateRandom(int k) {
 mpz_class encrypt(const mpz_class& m, const SecretKey& sk) {
     // Generate two random numbers, 'r' and 'r_prime', for noise.
     // The bit sizes here are parameters of the scheme (k2 and k0).
-    mpz_class r = generateRandom(80);
-    mpz_class r_prime = generateRandom(4096);
+    mpz_class r = generateRandom(k2_bits);
+    mpz_class r_prime = generateRandom(k0_bits);
 
     // Calculate c = (r*L + m) * (1 + r'*p) mod N
     mpz_class term1 = r * sk.L + m;
@@ -102,6 +239,268 @@ mpz_class decrypt(const mpz_class& c, const SecretKey& sk) {
     return m;
 }
 
+/**
+ * @brief  Constructs an empty encryption context.
+ * @param  sk             The secret key.
+ * @param  low_watermark  Pool size below which a background refill is started.
+ * @param  refill_batch   The number of masks added by each automatic refill.
+ */
+EncryptionContext::EncryptionContext(const SecretKey& sk, size_t low_watermark, size_t refill_batch)
+    : sk(sk), low_watermark(low_watermark), refill_batch(refill_batch), refilling(false), stopping(false) {
+}
+
+/**
+ * @brief  Stops any background refill and releases the pool.
+ */
+EncryptionContext::~EncryptionContext() {
+    stopping = true;
+    if (refiller.joinable()) {
+        refiller.join();
+    }
+}
+
+/**
+ * @brief  Computes one fresh mask.
+ * @note   (1 + r'*p) is congruent to 1 mod p, so multiplying by it leaves
+ *         c mod p, and therefore the plaintext, unchanged.
+ * @return The mask (1 + r'*p) mod N.
+ */
+mpz_class EncryptionContext::make_mask() const {
+    mpz_class r_prime = generateRandom(k0_bits);
+    mpz_class mask = (1 + r_prime * sk.p) % sk.N;
+    return mask;
+}
+
+/**
+ * @brief  Offline phase: adds `count` masks to the pool.
+ * @param  count    The number of masks to precompute.
+ * @param  workers  The number of threads.
+ */
+void EncryptionContext::precompute(size_t count, int workers) {
+    parallel_for(static_cast<int>(count), workers, [&](int, int begin, int end) {
+        for (int i = begin; i < end && !stopping; ++i) {
+            // The mask is computed outside the lock so concurrent encryptions are not stalled.
+            mpz_class mask = make_mask();
+            std::lock_guard<std::mutex> lock(pool_mutex);
+            pool.push_back(std::move(mask));
+        }
+    });
+}
+
+/**
+ * @brief  Adds `count` masks to the pool on a background thread.
+ * @param  count  The number of masks to precompute.
+ */
+void EncryptionContext::refill_async(size_t count) {
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    if (refilling) {
+        return;
+    }
+    start_refiller(count);
+}
+
+/**
+ * @brief  Tops the mask pool and the bit pools up to the given sizes on a background thread.
+ * @param  masks  The mask pool size to reach.
+ * @param  zeros  The size to reach for the pool of encryptions of 0.
+ * @param  ones   The size to reach for the pool of encryptions of 1.
+ */
+void EncryptionContext::top_up_async(size_t masks, size_t zeros, size_t ones) {
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    top_up_requested = true;
+    top_up_sizes[0] = masks;
+    top_up_sizes[1] = zeros;
+    top_up_sizes[2] = ones;
+    if (!refilling) {
+        start_refiller(0);
+    }
+}
+
+/**
+ * @brief  Starts the background thread with a refill of `count` masks.
+ * @note   Before it ends, the thread serves the top-ups requested while it ran.
+ *         It clears `refilling` under pool_mutex, so a request made under the
+ *         lock is either seen by the thread or starts a new one.
+ */
+void EncryptionContext::start_refiller(size_t count) {
+    // A previous refill has finished but its thread has not been reaped yet.
+    if (refiller.joinable()) {
+        refiller.join();
+    }
+    refilling = true;
+    refiller = std::thread([this, count]() {
+        precompute(count);
+        for (;;) {
+            size_t masks, zeros, ones;
+            {
+                std::lock_guard<std::mutex> lock(pool_mutex);
+                if (!top_up_requested || stopping) {
+                    refilling = false;
+                    return;
+                }
+                top_up_requested = false;
+                masks = top_up_sizes[0] - std::min(top_up_sizes[0], pool.size());
+                zeros = top_up_sizes[1] - std::min(top_up_sizes[1], bit_pools[0].size());
+                ones = top_up_sizes[2] - std::min(top_up_sizes[2], bit_pools[1].size());
+            }
+            precompute_bits(zeros, ones);
+            precompute(masks);
+        }
+    });
+}
+
+/**
+ * @brief  Removes one mask from the pool, or computes one inline if the pool is empty.
+ * @return A mask that has not been used before.
+ */
+mpz_class EncryptionContext::take_mask() {
+    bool pooled = false;
+    bool low = false;
+    mpz_class mask;
+    {
+        std::lock_guard<std::mutex> lock(pool_mutex);
+        if (!pool.empty()) {
+            mask = std::move(pool.front());
+            pool.pop_front();
+            pooled = true;
+        }
+        low = pool.size() < low_watermark;
+    }
+    if (low && refill_batch > 0) {
+        refill_async(refill_batch);
+    }
+    if (!pooled) {
+        // The pool ran dry: pay the offline cost inline.
+        mask = make_mask();
+    }
+    return mask;
+}
+
+/**
+ * @brief  Online phase: encrypts a message with a pooled mask.
+ * @param  m  The plaintext message.
+ * @return The ciphertext ((r*L + m) * mask) mod N.
+ */
+mpz_class EncryptionContext::encrypt(const mpz_class& m) {
+    mpz_class r = generateRandom(k2_bits);
+    mpz_class c = ((r * sk.L + m) * take_mask()) % sk.N;
+    return c;
+}
+
+/**
+ * @brief  Offline phase: adds ready ciphertexts of 0 and of 1 to the bit pools.
+ * @note   The zeros and ones are split across the workers as one range.
+ * @param  zeros    The number of encryptions of 0 to precompute.
+ * @param  ones     The number of encryptions of 1 to precompute.
+ * @param  workers  The number of threads.
+ */
+void EncryptionContext::precompute_bits(size_t zeros, size_t ones, int workers) {
+    parallel_for(static_cast<int>(zeros + ones), workers, [&](int, int begin, int end) {
+        for (int i = begin; i < end && !stopping; ++i) {
+            const int bit = static_cast<size_t>(i) < zeros ? 0 : 1;
+            // Fresh masks are made here rather than drawn from the mask pool, which
+            // stays reserved for encrypting other values online.
+            mpz_class r = generateRandom(k2_bits);
+            mpz_class c = ((r * sk.L + bit) * make_mask()) % sk.N;
+            std::lock_guard<std::mutex> lock(pool_mutex);
+            bit_pools[bit].push_back(std::move(c));
+        }
+    });
+}
+
+/**
+ * @brief  Online phase: encrypts a single bit, from its pool if possible.
+ * @param  bit  The plaintext bit, 0 or 1.
+ * @return A fresh encryption of the bit.
+ */
+mpz_class EncryptionContext::encrypt_bit(int bit) {
+    bit = bit ? 1 : 0;
+    {
+        std::lock_guard<std::mutex> lock(pool_mutex);
+        if (!bit_pools[bit].empty()) {
+            mpz_class c = std::move(bit_pools[bit].front());
+            bit_pools[bit].pop_front();
+            return c;
+        }
+    }
+    return encrypt(mpz_class(bit));
+}
+
+/**
+ * @brief  Returns the number of masks currently in the pool.
+ */
+size_t EncryptionContext::available() const {
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    return pool.size();
+}
+
+/**
+ * @brief  Returns the number of ready ciphertexts of a bit in its pool.
+ */
+size_t EncryptionContext::available_bits(int bit) const {
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    return bit_pools[bit ? 1 : 0].size();
+}
+
+/**
+ * @brief  Constructs a decryptor for a secret key.
+ * @param  sk       The secret key.
+ * @param  workers  The number of worker threads used per batch.
+ */
+BatchDecryptor::BatchDecryptor(const SecretKey& sk, int workers) : sk(sk), workers(std::max(1, workers)) {
+}
+
+/**
+ * @brief  Decrypts every ciphertext of a vector in place.
+ * @note   The reduction is left to mpz_tdiv_r (see the class comment for the
+ *         Barrett and Montgomery alternatives that were measured slower).
+ * @param  values  The ciphertexts; replaced by their plaintexts.
+ */
+void BatchDecryptor::decrypt(std::vector<mpz_class>& values) const {
+    parallel_for(static_cast<int>(values.size()), workers, [&](int, int begin, int end) {
+        mpz_class scratch;
+        for (int i = begin; i < end; ++i) {
+            // m = (c mod p) mod L, written back into the ciphertext's own storage.
+            mpz_tdiv_r(scratch.get_mpz_t(), values[i].get_mpz_t(), sk.p.get_mpz_t());
+            mpz_tdiv_r(values[i].get_mpz_t(), scratch.get_mpz_t(), sk.L.get_mpz_t());
+        }
+    });
+}
+
+/**
+ * @brief  Tests whether a ciphertext decrypts to zero.
+ * @param  c        The ciphertext.
+ * @param  scratch  A caller-owned temporary.
+ * @return `true` if the plaintext is zero.
+ */
+bool BatchDecryptor::is_zero(const mpz_class& c, mpz_class& scratch) const {
+    mpz_tdiv_r(scratch.get_mpz_t(), c.get_mpz_t(), sk.p.get_mpz_t());
+    return mpz_divisible_p(scratch.get_mpz_t(), sk.L.get_mpz_t()) != 0;
+}
+
+/**
+ * @brief  Counts the ciphertexts of a vector that decrypt to zero.
+ * @param  values  The ciphertexts.
+ * @return The number of zero plaintexts.
+ */
+size_t BatchDecryptor::count_zeros(const std::vector<mpz_class>& values) const {
+    std::vector<size_t> zeros(workers, 0);
+    parallel_for(static_cast<int>(values.size()), workers, [&](int worker, int begin, int end) {
+        mpz_class scratch;
+        for (int i = begin; i < end; ++i) {
+            if (is_zero(values[i], scratch)) {
+                zeros[worker]++;
+            }
+        }
+    });
+
+    size_t total = 0;
+    for (size_t z : zeros) {
+        total += z;
+    }
+    return total;
+}
+
 // NOTE: The main() function and extensive test code have been removed to create a clean
 // library implementation file. It is best practice to place testing code in a
 // separate file (e.g., test_main.cpp) that links against this object file.
\ No newline at end of file
@@ -15,6 +15,13 @@
 #define SHE_H
 
 #include <gmpxx.h>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <atomic>
 
 /**
  * @class SecretKey
@@ -43,13 +50,80 @@ public:
     SecretKey(const mpz_class& p, const mpz_class& q, const mpz_class& L);
 };
 
+/**
+ * @class RandomStream
+ * @brief A ChaCha20 keystream used as the scheme's source of randomness.
+ *
+ * A stream is seeded once from std::random_device and then produces random
+ * integers by importing keystream bytes straight into the mpz limbs. Streams
+ * are not thread-safe; use thread_instance() to get the calling thread's own.
+ */
+class RandomStream {
+public:
+    /**
+     * @brief  Seeds a new stream with a 256-bit key and a 64-bit nonce from std::random_device.
+     */
+    RandomStream();
+
+    RandomStream(const RandomStream&) = delete;
+    RandomStream& operator=(const RandomStream&) = delete;
+
+    /**
+     * @brief  Copies the next `count` bytes of keystream into `out`.
+     */
+    void fill_bytes(uint8_t *out, size_t count);
+
+    /**
+     * @brief  Sets `out` to a uniformly random integer of at most k bits.
+     */
+    void next(mpz_class& out, int k);
+
+    /**
+     * @brief  Fills out[0..count) with independent random integers of at most k bits.
+     */
+    void next(mpz_class *out, size_t count, int k);
+
+    /**
+     * @brief  Returns the calling thread's stream, seeding it on first use.
+     */
+    static RandomStream& thread_instance();
+
+    // A stream is a UniformRandomBitGenerator, so it can drive std::shuffle and
+    // the standard distributions.
+    using result_type = uint64_t;
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() { return UINT64_MAX; }
+
+    /**
+     * @brief  Returns the next 64 bits of keystream.
+     */
+    result_type operator()();
+
+private:
+    /// Produces the next batch of keystream blocks into the buffer.
+    void refill();
+
+    uint32_t state[16];
+    uint8_t buffer[1024];
+    size_t position;
+    std::vector<uint8_t> bytes; ///< Scratch for next(), reused across calls.
+};
+
 /**
  * @brief  Generates a cryptographically suitable random number of k bits.
  * @param  k  The desired number of bits for the random number.
- * @return An mpz_class integer with approximately k random bits.
+ * @return An mpz_class integer with k random bits.
  */
 mpz_class generateRandom(int k);
 
+/**
+ * @brief  Generates many random numbers of k bits from the calling thread's stream.
+ * @param  k      The desired number of bits for each random number.
+ * @param  count  The number of values to generate.
+ * @return A vector of `count` integers with k random bits each.
+ */
+std::vector<mpz_class> generateRandomBatch(int k, size_t count);
+
 /**
  * @brief  Encrypts a plaintext message using the provided secret key.
  * @param  m   The plaintext message (an mpz_class integer) to be encrypted.
@@ -67,4 +141,178 @@ mpz_class encrypt(const mpz_class& m, const SecretKey& sk);
  */
 mpz_class decrypt(const mpz_class& c, const SecretKey& sk);
 
+/**
+ * @class EncryptionContext
+ * @brief Splits encryption into an offline and an online phase.
+ *
+ * The expensive part of encrypt() is the mask (1 + r'*p) mod N, which does not
+ * depend on the message. The context precomputes a pool of such masks offline,
+ * so that encrypting online costs a single multiply-mod by a pooled mask. The
+ * pool can be refilled on a background thread, and encryption falls back to
+ * computing a fresh mask inline when the pool runs dry. Every mask is used at
+ * most once. All public methods are safe to call from multiple threads.
+ */
+class EncryptionContext {
+public:
+    /**
+     * @brief  Constructs an empty encryption context.
+     * @param  sk             The secret key; must outlive the context.
+     * @param  low_watermark  When the pool drops below this size after an
+     *                        encryption, a background refill is started (0 disables).
+     * @param  refill_batch   The number of masks added by each automatic refill.
+     */
+    explicit EncryptionContext(const SecretKey& sk, size_t low_watermark = 0, size_t refill_batch = 0);
+
+    /**
+     * @brief  Stops any background refill and releases the pool.
+     */
+    ~EncryptionContext();
+
+    EncryptionContext(const EncryptionContext&) = delete;
+    EncryptionContext& operator=(const EncryptionContext&) = delete;
+
+    /**
+     * @brief  Offline phase: adds `count` masks to the pool.
+     * @param  count    The number of masks to precompute.
+     * @param  workers  The number of threads; the calling thread is one of them.
+     */
+    void precompute(size_t count, int workers = 1);
+
+    /**
+     * @brief  Adds `count` masks to the pool on a background thread.
+     * @note   Does nothing if a background refill is already running.
+     * @param  count  The number of masks to precompute.
+     */
+    void refill_async(size_t count);
+
+    /**
+     * @brief  Tops the mask pool and the bit pools up to the given sizes on a
+     *         background thread.
+     * @note   Never blocks on a running refill: that refill tops up before it
+     *         ends. The amounts are worked out when the top-up starts, so the
+     *         pools reach the sizes even if they are drawn from meanwhile.
+     * @param  masks  The mask pool size to reach.
+     * @param  zeros  The size to reach for the pool of encryptions of 0.
+     * @param  ones   The size to reach for the pool of encryptions of 1.
+     */
+    void top_up_async(size_t masks, size_t zeros, size_t ones);
+
+    /**
+     * @brief  Online phase: encrypts a message with a pooled mask.
+     * @note   Produces the same ciphertext distribution as encrypt().
+     * @param  m  The plaintext message, in the range [0, L-1].
+     * @return The ciphertext ((r*L + m) * mask) mod N.
+     */
+    mpz_class encrypt(const mpz_class& m);
+
+    /**
+     * @brief  Offline phase: adds ready ciphertexts of 0 and of 1 to the bit pools.
+     * @note   Query filters only hold bits, so a whole ciphertext can be prepared
+     *         ahead of time rather than just its mask.
+     * @param  zeros    The number of encryptions of 0 to precompute.
+     * @param  ones     The number of encryptions of 1 to precompute.
+     * @param  workers  The number of threads; the calling thread is one of them.
+     */
+    void precompute_bits(size_t zeros, size_t ones, int workers = 1);
+
+    /**
+     * @brief  Online phase: encrypts a single bit.
+     * @note   Removes a ready ciphertext from the bit's pool, so the online cost is
+     *         a lookup. Every pooled ciphertext is used at most once, so no two
+     *         queries share a ciphertext. Falls back to encrypt() when the pool is empty.
+     * @param  bit  The plaintext bit, 0 or 1.
+     * @return A fresh encryption of the bit.
+     */
+    mpz_class encrypt_bit(int bit);
+
+    /**
+     * @brief  Returns the number of masks currently in the pool.
+     */
+    size_t available() const;
+
+    /**
+     * @brief  Returns the number of ready ciphertexts of a bit in its pool.
+     */
+    size_t available_bits(int bit) const;
+
+private:
+    /// Computes one fresh mask (1 + r'*p) mod N.
+    mpz_class make_mask() const;
+
+    /// Removes one mask from the pool, or computes one inline if the pool is empty.
+    mpz_class take_mask();
+
+    /// Starts the background thread with a refill of `count` masks; pool_mutex must be held.
+    void start_refiller(size_t count);
+
+    const SecretKey& sk;
+    size_t low_watermark;
+    size_t refill_batch;
+
+    mutable std::mutex pool_mutex;
+    std::deque<mpz_class> pool;
+    std::deque<mpz_class> bit_pools[2]; ///< Ready encryptions of 0 and of 1.
+    bool top_up_requested = false;      ///< Whether the background thread still has to top up.
+    size_t top_up_sizes[3] = {};        ///< The mask, 0 and 1 pool sizes the top-up reaches.
+
+    std::thread refiller;
+    std::atomic<bool> refilling;
+    std::atomic<bool> stopping;
+};
+
+/**
+ * @class BatchDecryptor
+ * @brief Decrypts whole vectors of ciphertexts with reusable scratch state.
+ *
+ * Decryption only needs the residue of c modulo the secret prime p (the CRT
+ * component of N that carries the plaintext), followed by a reduction mod L.
+ * The decryptor keeps one scratch integer per worker so the limb buffers are
+ * allocated once per batch, and splits a batch across worker threads. Since
+ * the plaintext is zero exactly when (c mod p) is divisible by L, counting zero
+ * buckets never has to materialise the plaintext.
+ *
+ * The reduction mod p is left to GMP's division, which already works with a
+ * precomputed inverse of p's top limb; no other reduction state is kept for p.
+ * Two alternatives were measured on 4096-bit ciphertexts and a 2048-bit p, and
+ * both were slower. A Barrett reduction built from mpz operations was no faster.
+ * A limb-level Montgomery reduction (the REDC of CiphertextVector::mont_mul,
+ * with a Modulus for p) costs about 3.2 us per zero test against 2.4 us. REDC
+ * yields c * R^-1 mod p, and divisibility by L only holds for c mod p itself,
+ * so a second multiplication by R^2 is needed to cancel R^-1.
+ */
+class BatchDecryptor {
+public:
+    /**
+     * @brief  Constructs a decryptor for a secret key.
+     * @param  sk       The secret key; must outlive the decryptor.
+     * @param  workers  The number of worker threads used per batch.
+     */
+    explicit BatchDecryptor(const SecretKey& sk, int workers = 1);
+
+    /**
+     * @brief  Decrypts every ciphertext of a vector in place.
+     * @param  values  The ciphertexts; replaced by their plaintexts.
+     */
+    void decrypt(std::vector<mpz_class>& values) const;
+
+    /**
+     * @brief  Tests whether a ciphertext decrypts to zero.
+     * @param  c        The ciphertext.
+     * @param  scratch  A caller-owned temporary holding c mod p on return.
+     * @return `true` if the plaintext is zero.
+     */
+    bool is_zero(const mpz_class& c, mpz_class& scratch) const;
+
+    /**
+     * @brief  Counts the ciphertexts of a vector that decrypt to zero.
+     * @param  values  The ciphertexts.
+     * @return The number of zero plaintexts.
+     */
+    size_t count_zeros(const std::vector<mpz_class>& values) const;
+
+private:
+    const SecretKey& sk;
+    int workers;
+};
+
 #endif // SHE_H
\ No newline at end of file
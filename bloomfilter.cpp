@@ -15,34 +15,20 @@
  */
 
 #include "bloomfilter.h"
-#include "MurmurHash3.h"
+#include "hashing.h"
 #include <cmath>   // Required for log()
-#include <string>  // Required for std::to_string
-#include <cstdlib> // Required for malloc, calloc, free
-
-// --- Internal Function Prototypes ---
-// This function is intended for internal use within this file.
-double hash_result(int data_id, int length, int seed);
-
+#include <cstdlib> // Required for malloc, aligned_alloc, free
+#include <cstring> // Required for memset
 
 /**
- * @brief  Creates and allocates a new Bloom Filter.
- * @note   The caller is responsible for freeing the allocated memory by calling
- *         destroy_bloom_filter() to prevent memory leaks.
- * @param  expected_elements    The anticipated number of items to be stored.
- * @param  false_positive_rate  The desired false positive probability (e.g., 0.01 for 1%).
+ * @brief  Internal helper that allocates a zeroed filter of a given geometry.
+ * @param  size        The number of bits.
+ * @param  hash_count  The number of hash functions.
+ * @param  blocked     Whether the cache-line blocked layout is used.
+ * @param  hash_scheme The HashScheme used to derive the probe positions.
  * @return A pointer to the newly created BloomFilter struct, or NULL on allocation failure.
  */
-BloomFilter *create_bloom_filter(int expected_elements, double false_positive_rate) {
-    // Calculate the optimal bit array size 'm' using the standard formula:
-    // m = -(n * ln(p)) / (ln(2)^2)
-    // where 'n' is expected_elements and 'p' is false_positive_rate.
-    int size = (int)(-expected_elements * log(false_positive_rate) / (log(2) * log(2)));
-    
-    // Round up the size to the nearest multiple of 8. This is a common integer
-    // arithmetic trick that can sometimes offer memory alignment benefits.
-    size = (size + 7) / 8 * 8;
-
+static BloomFilter *allocate_bloom_filter(int size, int hash_count, int blocked, int hash_scheme) {
     // Allocate memory for the main BloomFilter struct.
     BloomFilter *filter = (BloomFilter*)malloc(sizeof(BloomFilter));
     if (filter == NULL) {
@@ -50,24 +36,137 @@ BloomFilter *create_bloom_filter(int expected_elements, double false_positive_ra
         return NULL;
     }
 
-    // Allocate memory for the bit array. calloc is used to initialize all bits to zero.
-    filter->bits = (int*)calloc(size, sizeof(int));
-    if (filter->bits == NULL) {
+    // Allocate the packed bit array aligned to a cache line, so that every
+    // BLOOM_BLOCK_BITS block of a blocked filter is exactly one line.
+    // aligned_alloc requires the byte count to be a multiple of the alignment.
+    size_t words = (size_t)(size + 63) / 64;
+    size_t bytes = (words * sizeof(uint64_t) + 63) / 64 * 64;
+    filter->words = (uint64_t*)aligned_alloc(64, bytes);
+    if (filter->words == NULL) {
         // If bit array allocation fails, free the already allocated struct and return NULL.
         free(filter);
         return NULL;
     }
-    
+    memset(filter->words, 0, bytes);
+
     filter->size = size;
-    
-    // Set the number of hash functions.
-    // NOTE: A fixed value is used for simplicity. For a truly optimal filter, this
-    // should be calculated dynamically using the formula: k = (m / n) * ln(2).
-    filter->hash_count = 7;
-    
+    filter->hash_count = hash_count;
+    filter->blocked = blocked;
+    filter->hash_scheme = hash_scheme;
     return filter;
 }
 
+/**
+ * @brief  Internal helper that sizes a filter with the standard formulas.
+ * @param  expected_elements    The anticipated number of items to be stored.
+ * @param  false_positive_rate  The desired false positive probability.
+ * @param  size                 Output: the bit array size (m), a multiple of 8.
+ * @param  hash_count           Output: the number of hash functions (k).
+ */
+static void size_bloom_filter(int expected_elements, double false_positive_rate, int *size, int *hash_count) {
+    // Calculate the optimal bit array size 'm' using the standard formula:
+    // m = -(n * ln(p)) / (ln(2)^2)
+    // where 'n' is expected_elements and 'p' is false_positive_rate.
+    int m = (int)(-expected_elements * log(false_positive_rate) / (log(2) * log(2)));
+
+    // Round up the size to the nearest multiple of 8. This is a common integer
+    // arithmetic trick that can sometimes offer memory alignment benefits.
+    m = (m + 7) / 8 * 8;
+    if (m < 8) {
+        m = 8;
+    }
+
+    // Calculate the optimal number of hash functions: k = (m / n) * ln(2).
+    // It is capped by the multiplicative depth the encrypted test can afford.
+    int k = (int)lround((double)m / (expected_elements > 0 ? expected_elements : 1) * log(2));
+    if (k < 1) {
+        k = 1;
+    }
+    if (k > BLOOM_MAX_HASH_COUNT) {
+        k = BLOOM_MAX_HASH_COUNT;
+    }
+
+    *size = m;
+    *hash_count = k;
+}
+
+/**
+ * @brief  Creates and allocates a new Bloom Filter.
+ * @note   The caller is responsible for freeing the allocated memory by calling
+ *         destroy_bloom_filter() to prevent memory leaks.
+ * @param  expected_elements    The anticipated number of items to be stored.
+ * @param  false_positive_rate  The desired false positive probability (e.g., 0.01 for 1%).
+ * @param  hash_scheme          The HashScheme used to derive the probe positions.
+ * @return A pointer to the newly created BloomFilter struct, or NULL on allocation failure.
+ */
+BloomFilter *create_bloom_filter(int expected_elements, double false_positive_rate, int hash_scheme) {
+    int size, hash_count;
+    size_bloom_filter(expected_elements, false_positive_rate, &size, &hash_count);
+    return allocate_bloom_filter(size, hash_count, 0, hash_scheme);
+}
+
+/**
+ * @brief  Creates a Bloom Filter with the cache-line blocked layout.
+ * @param  expected_elements    The anticipated number of items to be stored.
+ * @param  false_positive_rate  The desired false positive probability.
+ * @param  hash_scheme          The HashScheme used to derive the probe positions.
+ * @return A pointer to the newly created BloomFilter struct, or NULL on allocation failure.
+ */
+BloomFilter *create_blocked_bloom_filter(int expected_elements, double false_positive_rate, int hash_scheme) {
+    int size, hash_count;
+    size_bloom_filter(expected_elements, false_positive_rate, &size, &hash_count);
+
+    // Round up to a whole number of blocks.
+    size = (size + BLOOM_BLOCK_BITS - 1) / BLOOM_BLOCK_BITS * BLOOM_BLOCK_BITS;
+    return allocate_bloom_filter(size, hash_count, 1, hash_scheme);
+}
+
+/**
+ * @brief  Computes the probe positions of an element.
+ * @param  geometry  The geometry of the filter.
+ * @param  data_id   The integer element.
+ * @param  indices   Output array of at least geometry->hash_count positions.
+ */
+void bloom_filter_probe(const BloomGeometry *geometry, int data_id, int *indices) {
+    const int size = geometry->size;
+    const int blocks = size / BLOOM_BLOCK_BITS;
+    // A filter smaller than one block cannot be blocked; it is probed as a plain one.
+    const bool blocked = geometry->blocked && blocks > 0;
+
+    if (geometry->hash_scheme == HASH_SCHEME_STRING_KEY) {
+        if (!blocked) {
+            // A different seed (i) is used for each iteration to simulate multiple hash functions.
+            for (int i = 0; i < geometry->hash_count; ++i) {
+                indices[i] = (int)(hash_string_key(data_id, size, i) % size);
+            }
+            return;
+        }
+        // Seed 0 picks the block; seeds 1..k pick the bits inside it.
+        int base = (int)(hash_string_key(data_id, blocks, 0) % blocks) * BLOOM_BLOCK_BITS;
+        for (int i = 0; i < geometry->hash_count; ++i) {
+            indices[i] = base + (int)(hash_string_key(data_id, size, i + 1) % size) % BLOOM_BLOCK_BITS;
+        }
+        return;
+    }
+
+    // One 128-bit hash of the raw (element, size) pair yields every probe.
+    const int32_t key[2] = { data_id, size };
+    uint64_t h[2];
+    hash_int_key128(key, 2, 0, h);
+
+    if (!blocked) {
+        for (int i = 0; i < geometry->hash_count; ++i) {
+            indices[i] = (int)(double_hash(h, i) % (uint64_t)size);
+        }
+        return;
+    }
+    // Hash 0 picks the block; hashes 1..k pick the bits inside it.
+    int base = (int)(double_hash(h, 0) % (uint64_t)blocks) * BLOOM_BLOCK_BITS;
+    for (int i = 0; i < geometry->hash_count; ++i) {
+        indices[i] = base + (int)(double_hash(h, i + 1) % BLOOM_BLOCK_BITS);
+    }
+}
+
 /**
  * @brief  Inserts an element into the Bloom Filter.
  * @note   This operation is idempotent; inserting the same element multiple
@@ -76,12 +175,13 @@ BloomFilter *create_bloom_filter(int expected_elements, double false_positive_ra
  * @param  data_id    The integer element to be added to the set.
  */
 void bloom_filter_insert(BloomFilter *bf, int data_id) {
-    // For each hash function, calculate a hash value and set the corresponding bit.
+    BloomGeometry geometry = bloom_filter_geometry(bf);
+    int indices[BLOOM_MAX_HASH_COUNT];
+    bloom_filter_probe(&geometry, data_id, indices);
+
+    // For each hash function, set the corresponding bit.
     for (int i = 0; i < bf->hash_count; ++i) {
-        // A different seed (i) is used for each iteration to simulate multiple hash functions.
-        int bit_index = (int)hash_result(data_id, bf->size, i);
-        // Set the bit at the computed index to 1.
-        bf->bits[bit_index] = 1;
+        bf->words[indices[i] >> 6] |= (uint64_t)1 << (indices[i] & 63);
     }
 }
 
@@ -95,11 +195,14 @@ void bloom_filter_insert(BloomFilter *bf, int data_id) {
  * @return `true` if the element may be in the set, `false` otherwise.
  */
 bool bloom_filter_contains(BloomFilter *bf, int data_id) {
+    BloomGeometry geometry = bloom_filter_geometry(bf);
+    int indices[BLOOM_MAX_HASH_COUNT];
+    bloom_filter_probe(&geometry, data_id, indices);
+
     for (int i = 0; i < bf->hash_count; ++i) {
-        int bit_index = (int)hash_result(data_id, bf->size, i);
         // If any of the bits at the hashed indices is 0, the element is
         // guaranteed to not be in the set.
-        if (bf->bits[bit_index] == 0) {
+        if (bloom_filter_get_bit(bf, indices[i]) == 0) {
             return false;
         }
     }
@@ -108,6 +211,30 @@ bool bloom_filter_contains(BloomFilter *bf, int data_id) {
     return true;
 }
 
+/**
+ * @brief  Reads a single bit of the filter.
+ * @param  bf     A pointer to a valid BloomFilter instance.
+ * @param  index  The bit position.
+ * @return 1 if the bit is set, 0 otherwise.
+ */
+int bloom_filter_get_bit(const BloomFilter *bf, int index) {
+    return (int)((bf->words[index >> 6] >> (index & 63)) & 1);
+}
+
+/**
+ * @brief  Returns the geometry of a filter.
+ * @param  bf  A pointer to a valid BloomFilter instance.
+ * @return The size, hash count and layout of the filter.
+ */
+BloomGeometry bloom_filter_geometry(const BloomFilter *bf) {
+    BloomGeometry geometry;
+    geometry.size = bf->size;
+    geometry.hash_count = bf->hash_count;
+    geometry.blocked = bf->blocked;
+    geometry.hash_scheme = bf->hash_scheme;
+    return geometry;
+}
+
 /**
  * @brief  Frees all memory associated with a Bloom Filter.
  * @note   This function safely handles being called with a NULL pointer.
@@ -117,32 +244,23 @@ void destroy_bloom_filter(BloomFilter *bf) {
     // Check for NULL pointer to prevent segfaults on double-free or freeing a NULL pointer.
     if (bf != NULL) {
         // The bit array must be freed first.
-        free(bf->bits);
+        free(bf->words);
         // Then, the container struct itself can be freed.
         free(bf);
     }
 }
 
 /**
- * @brief  Internal helper function to compute a single hash value.
+ * @brief  Computes a single hash value of the string-keyed scheme.
  * @note   This function uses the MurmurHash3 algorithm to generate a hash.
- *         It is not intended to be called directly from outside this file.
  * @param  data_id    The integer data to be hashed.
  * @param  length     The size of the bit array, used to map the hash to a valid index.
  * @param  seed       The seed for the MurmurHash3 function.
  * @return The resulting hash value, scaled to the range [0, length-1].
  */
 double hash_result(int data_id, int length, int seed) {
-    uint32_t hash_output;
-    
-    // Construct a key from the data and filter properties to ensure hash uniqueness
-    // across filters of different sizes.
-    std::string key = std::to_string(data_id) + "|" + std::to_string(length);
-    
-    // Execute the MurmurHash3 32-bit algorithm.
-    MurmurHash3_x86_32(key.c_str(), key.size(), seed, &hash_output);
-    
+    // The key "data_id|length" ensures hash uniqueness across filters of different sizes.
     // Use the modulo operator to map the 32-bit hash output to a valid
     // index within the bit array's bounds.
-    return hash_output % length;
-}
\ No newline at end of file
+    return hash_string_key(data_id, length, seed) % length;
+}
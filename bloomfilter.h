@@ -22,20 +22,52 @@
 #include <cmath>
 #include <cstdint>
 #include <stdbool.h> // Include for C-style 'bool' type if not in a C++ context
+#include "hashing.h"
+
+/**
+ * @brief  The largest number of hash functions a filter may use.
+ * @note   The data holder multiplies the encrypted filter entries at every
+ *         probe of x and of y, i.e. 2k ciphertexts per record. With the
+ *         current SHE parameters (16-bit noise, 80-bit L, 2048-bit p) the
+ *         plaintext product stays below p for up to 7 probes per dimension.
+ */
+#define BLOOM_MAX_HASH_COUNT 7
+
+/**
+ * @brief  The number of bits in one block of a blocked filter (one 64-byte cache line).
+ */
+#define BLOOM_BLOCK_BITS 512
 
 /**
  * @struct BloomFilter
  * @brief  The core data structure for a Bloom Filter.
- * @var    bits        A pointer to the dynamically allocated bit array.
+ * @var    words       A pointer to the packed bit array, 64 bits per word.
  * @var    size        The total number of bits in the bit array.
  * @var    hash_count  The number of hash functions (k) to be used.
+ * @var    blocked     Nonzero if all probes of a key fall in one BLOOM_BLOCK_BITS block.
+ * @var    hash_scheme The HashScheme used to derive the probe positions.
  */
 typedef struct {
-    int *bits;       // Pointer to the bit array.
+    uint64_t *words; // Pointer to the packed bit array (cache-line aligned).
     int size;        // The size of the bit array (m).
     int hash_count;  // The number of hash functions to use (k).
+    int blocked;     // Whether the cache-line blocked layout is used.
+    int hash_scheme; // The HashScheme of the probes.
 } BloomFilter;
 
+/**
+ * @struct BloomGeometry
+ * @brief  The parameters that decide where a key's probes land.
+ * @note   The data holder never sees the filter itself, only its encryption,
+ *         so it rebuilds the probe positions from these values alone.
+ */
+typedef struct {
+    int size;        // The size of the bit array (m).
+    int hash_count;  // The number of hash functions (k).
+    int blocked;     // Whether the cache-line blocked layout is used.
+    int hash_scheme; // The HashScheme of the probes.
+} BloomGeometry;
+
 
 /**
  * @brief  Creates and allocates a new Bloom Filter.
@@ -43,9 +75,26 @@ typedef struct {
  *         destroy_bloom_filter() to prevent memory leaks.
  * @param  expected_elements    The anticipated number of items to be stored.
  * @param  false_positive_rate  The desired false positive probability (e.g., 0.01 for 1%).
+ * @param  hash_scheme          The HashScheme used to derive the probe positions.
+ * @return A pointer to the newly created BloomFilter struct, or NULL on allocation failure.
+ */
+BloomFilter *create_bloom_filter(int expected_elements, double false_positive_rate,
+                                 int hash_scheme = HASH_SCHEME_DOUBLE);
+
+
+/**
+ * @brief  Creates a Bloom Filter with the cache-line blocked layout.
+ * @note   The first hash selects one BLOOM_BLOCK_BITS block and all k probes of
+ *         the key are placed inside it, so a lookup touches a single cache line.
+ *         The size is rounded up to a whole number of blocks. The false positive
+ *         rate is slightly higher than for the standard layout of the same size.
+ * @param  expected_elements    The anticipated number of items to be stored.
+ * @param  false_positive_rate  The desired false positive probability.
+ * @param  hash_scheme          The HashScheme used to derive the probe positions.
  * @return A pointer to the newly created BloomFilter struct, or NULL on allocation failure.
  */
-BloomFilter *create_bloom_filter(int expected_elements, double false_positive_rate);
+BloomFilter *create_blocked_bloom_filter(int expected_elements, double false_positive_rate,
+                                         int hash_scheme = HASH_SCHEME_DOUBLE);
 
 
 /**
@@ -69,6 +118,36 @@ bool bloom_filter_contains(BloomFilter *bf, int data_id);
 
 
 
+/**
+ * @brief  Reads a single bit of the filter.
+ * @param  bf     A pointer to a valid BloomFilter instance.
+ * @param  index  The bit position, in the range [0, size-1].
+ * @return 1 if the bit is set, 0 otherwise.
+ */
+int bloom_filter_get_bit(const BloomFilter *bf, int index);
+
+
+/**
+ * @brief  Returns the geometry of a filter.
+ * @param  bf  A pointer to a valid BloomFilter instance.
+ * @return The size, hash count and layout of the filter.
+ */
+BloomGeometry bloom_filter_geometry(const BloomFilter *bf);
+
+
+/**
+ * @brief  Computes the probe positions of an element.
+ * @note   This is the single definition of where an element lands; the filter
+ *         operations and the data holder's encrypted membership test both use it.
+ *         A blocked geometry smaller than BLOOM_BLOCK_BITS is probed unblocked.
+ * @param  geometry  The geometry of the filter.
+ * @param  data_id   The integer element.
+ * @param  indices   Output array of at least geometry->hash_count positions.
+ */
+void bloom_filter_probe(const BloomGeometry *geometry, int data_id, int *indices);
+
+
+
 /**
  * @brief  Frees all memory associated with a Bloom Filter.
  * @note   It is safe to call this function with a NULL pointer.
@@ -79,8 +158,8 @@ void destroy_bloom_filter(BloomFilter *bf);
 
 /**
  * @brief  Computes a hash value for a given data ID using a specific seed.
- * @note   This function is used internally by the filter's operations but is
- *         exposed as a public utility.
+ * @note   This is the i-th probe of the HASH_SCHEME_STRING_KEY scheme, exposed
+ *         as a public utility.
  * @param  data_id    The integer data to be hashed.
  * @param  length     The size of the bit array, used to map the hash to a valid index.
  * @param  seed       The seed for the hash function.
@@ -5,10 +5,13 @@
  *
  *    Description:  A center (the central aggregator) application that acts 
  *                  as a proxy and aggregator in PPRC. It receives an encrypted
- *                  query from a client, forwards it to data holder servers,
- *                  receives back multiple encrypted sketches, aggregates them,
- *                  applies privacy enhancements, and sends the final result
- *                  back to the client.
+ *                  query from a client, forwards it to all data holder servers
+ *                  concurrently, aggregates their encrypted sketches as they
+ *                  arrive, applies privacy enhancements, and sends the final
+ *                  result back to the client. In relay mode it instead serves
+ *                  as an inner node of an aggregation tree: it answers its
+ *                  parent like a data holder, with one partial sketch per query
+ *                  summed over its own children.
  *
  *        Version:  1.0
  *
@@ -22,93 +25,833 @@
 #include <algorithm>
 #include <chrono>
 #include <random>
+#include <memory>
+#include <deque>
+#include <string>
+#include <cstring>
+#include <stdexcept>
 #include <gmpxx.h>
+#include "wire.h"
+#include "ciphertext.h"
+#include "parallel.h"
+#include "SHE.h"
 
 using boost::asio::ip::tcp;
 
-// --- Global Static Random Number Generator ---
-// A static random engine is initialized once and used throughout the application's lifetime.
-// This ensures that sequences of random numbers are not repeated on successive function calls
-// within the same program run, which would happen if a new engine were seeded each time.
-static std::mt19937 gen(std::chrono::steady_clock::now().time_since_epoch().count());
+
+/**
+ * @struct DataHolderEndpoint
+ * @brief  The address of one data holder server, or of a relay that stands in for several.
+ */
+struct DataHolderEndpoint {
+    std::string host;
+    std::string port;
+};
 
 
 /**
- * @brief  Serializes and sends a vector of mpz_class numbers over a TCP socket.
- * @note   This function implements a custom binary protocol:
- *         1. A 4-byte header with the total buffer length is sent first.
- *         2. The main buffer follows, containing a sequence of numbers.
- *         3. Each number is encoded as [4-byte length][binary data].
- * @param  socket   The active Boost.Asio TCP socket.
- * @param  numbers  A constant reference to the vector of mpz_class to send.
+ * @brief  One chunk of a query, header and payload, as it arrived from upstream.
+ * @note   The write queues of all data holders share the same buffer.
  */
-void send_multiple_mpz_class(tcp::socket &socket, const std::vector<mpz_class> &numbers) {
-    std::vector<uint8_t> buffer;
+typedef std::shared_ptr<const std::vector<uint8_t>> QueryChunk;
 
-    // Pre-allocate buffer space to improve performance by reducing reallocations.
-    buffer.reserve(numbers.size() * 520);
 
-    for (const auto &num : numbers) {
-        size_t count = 0;
-        void *bin = mpz_export(nullptr, &count, 1, 1, 1, 0, num.get_mpz_t());
+/**
+ * @class SketchFanOut
+ * @brief Forwards one batch of queries to many data holders concurrently and
+ *        aggregates their sketches, query by query, as the replies arrive.
+ *
+ * All data holders are driven by asynchronous operations on one io_context, so
+ * the fan-out takes as long as the slowest data holder rather than the sum of
+ * all of them. Each data holder has its own deadline; when it expires the
+ * connection is closed and the data holder is counted as missing. Replies are
+ * read chunk by chunk and folded into a per-data-holder sum as each chunk
+ * arrives, so only one chunk is ever buffered per data holder. A reply is read
+ * while the query is still being written, since a data holder starts answering
+ * the first queries of a batch before it has received the last ones.
+ *
+ * The query is forwarded as it arrives from upstream: each chunk is queued to
+ * every data holder as soon as it has been read. The next chunk is only read
+ * once no data holder has more than max_queued_chunks waiting, so the center
+ * holds a window of the query rather than all of it, and the upstream sender
+ * is slowed down to the pace of the slowest data holder.
+ *
+ * A fan-out lives as long as the center and runs one batch at a time. The
+ * connection to a child stays open after a successful reply and carries the
+ * next batch. It is closed when the child fails, and reopened on the next
+ * batch; a kept connection the child closed while idle is reopened too.
+ */
+class SketchFanOut {
+public:
+    /**
+     * @brief  Prepares a fan-out to a list of data holders; nothing is connected yet.
+     * @param  io_context  The context that runs the asynchronous operations.
+     * @param  endpoints   The data holders to query.
+     * @param  timeout     The deadline of each data holder in a batch, from start to reply.
+     * @param  workers     The number of threads a completed reply is merged with.
+     */
+    SketchFanOut(boost::asio::io_context &io_context, const std::vector<DataHolderEndpoint> &endpoints,
+                 std::chrono::milliseconds timeout, int workers)
+        : io_context(io_context), timeout(timeout), workers(workers) {
+        for (const DataHolderEndpoint &endpoint : endpoints) {
+            links.emplace_back(new Link(io_context, endpoint));
+        }
+    }
 
-        uint32_t len = static_cast<uint32_t>(count);
-        uint8_t *len_ptr = reinterpret_cast<uint8_t *>(&len);
-        buffer.insert(buffer.end(), len_ptr, len_ptr + sizeof(len));
-        buffer.insert(buffer.end(), reinterpret_cast<uint8_t *>(bin), reinterpret_cast<uint8_t *>(bin) + len);
+    /**
+     * @brief  Forwards one batch to every data holder while the rest of it is read
+     *         from upstream, and waits for all replies or deadlines.
+     * @param  upstream        The connection the query arrives on; it must run on the
+     *                         fan-out's io_context.
+     * @param  head            The chunks of the query already read from upstream.
+     * @param  head_elements   The number of elements in `head`.
+     * @param  query_elements  The number of elements the whole query must hold.
+     * @param  modulus         The public modulus of the query; sketches are summed mod N.
+     *                         It must stay valid until the aggregate has been read.
+     * @param  batch_size      The number of range queries in the batch.
+     * @return Whether the whole query was read from upstream. If not, the batch has
+     *         failed and the upstream connection cannot carry another one.
+     */
+    bool run(tcp::socket &upstream, const std::vector<QueryChunk> &head, uint64_t head_elements,
+             uint64_t query_elements, const Modulus &modulus, long batch_size) {
+        this->upstream = &upstream;
+        this->modulus = &modulus;
+        this->batch_size = batch_size;
+        this->query_elements = query_elements;
+        query_received = head_elements;
+        query_read = false;
+        query_failed = false;
+        lc_sketch_agg = CiphertextAccumulator();
+        responded = 0;
+        sketch_total = 0;
+        expected_sketch_length = 0;
+        for (size_t i = 0; i < links.size(); i++) {
+            Link &link = *links[i];
+            link.received = 0;
+            link.providers = 0;
+            link.sketch_length = 0;
+            link.partial = CiphertextAccumulator();
+            link.outbox.assign(head.begin(), head.end());
+            link.connected = false;
+            link.sent = false;
+            link.done = false;
+            start(i);
+        }
+        read_query();
+        io_context.restart();
+        io_context.run();
+        return query_read;
+    }
 
-        free(bin);
+    /// The number of data holders whose sketches were aggregated.
+    int responses() const { return responded; }
+
+    /// The number of sketches per query summed into the aggregate. Each data holder
+    /// contributes one per simulated provider; a relay's partial sum counts as one.
+    int sketches() const { return sketch_total; }
+
+    /// The aggregated sketches, query by query, not yet reduced (empty if no data holder answered).
+    CiphertextAccumulator &aggregate() { return lc_sketch_agg; }
+
+    /// The length of each aggregated sketch.
+    size_t sketch_length() const { return lc_sketch_agg.size() / batch_size; }
+
+    /// The largest number of sketches per query a child may announce.
+    static const long max_reply_providers = 1 << 16;
+
+    /// The largest sketch length a child may announce.
+    static const long max_sketch_length = 1 << 24;
+
+    /// The largest partial sum, in bytes, a child's reply may make this center allocate.
+    static constexpr uint64_t max_partial_bytes = 4ull << 30;
+
+    /// The most query chunks queued for one data holder before upstream reading pauses.
+    static const size_t max_queued_chunks = 16;
+
+private:
+    /**
+     * @struct Link
+     * @brief  The connection state of one data holder.
+     */
+    struct Link {
+        DataHolderEndpoint endpoint;
+        tcp::socket socket;
+        boost::asio::steady_timer timer;
+        WireChunkHeader header;
+        std::vector<mp_limb_t> payload; ///< Chunk payload; limb-typed so sketch entries are added in place.
+        std::vector<mpz_class> chunk;   ///< Decoded variable-width elements.
+        std::deque<QueryChunk> outbox;  ///< Query chunks not yet written; the front one may be in flight.
+        uint64_t received = 0;          ///< Reply elements received so far.
+        long providers = 0;             ///< P from the reply header.
+        long sketch_length = 0;         ///< S from the reply header.
+        CiphertextAccumulator partial;  ///< For each query, this data holder's sum of its P sketches.
+        bool connected = false;         ///< Whether the socket is ready for this batch's query.
+        bool writing = false;           ///< Whether a query chunk is being written.
+        bool sent = false;              ///< Whether the whole query, end chunk included, was written.
+        bool done = false;              ///< Whether the current batch is over for this data holder.
+
+        Link(boost::asio::io_context &io_context, const DataHolderEndpoint &endpoint)
+            : endpoint(endpoint), socket(io_context), timer(io_context) {
+        }
+    };
+
+    /**
+     * @brief  Tests whether a kept connection can no longer carry a batch.
+     * @note   Nothing is due from a child between batches, so a socket with anything
+     *         to read was closed by the child (e.g. it restarted) or is out of step.
+     */
+    static bool idle_connection_broken(tcp::socket &socket) {
+        boost::system::error_code ec;
+        uint8_t byte;
+        socket.non_blocking(true, ec);
+        socket.receive(boost::asio::buffer(&byte, 1), tcp::socket::message_peek, ec);
+        boost::system::error_code ignored;
+        socket.non_blocking(false, ignored);
+        return ec != boost::asio::error::would_block;
     }
 
-    uint32_t total_length = static_cast<uint32_t>(buffer.size());
-    boost::asio::write(socket, boost::asio::buffer(&total_length, sizeof(total_length)));
-    boost::asio::write(socket, boost::asio::buffer(buffer));
-}
+    /**
+     * @brief  Starts the deadline of one data holder and its exchange.
+     */
+    void start(size_t i) {
+        Link &link = *links[i];
+
+        link.timer.expires_after(timeout);
+        link.timer.async_wait([this, i](const boost::system::error_code &ec) {
+            if (!ec) {
+                finish(i, "timed out");
+            }
+        });
+
+        if (link.socket.is_open() && !idle_connection_broken(link.socket)) {
+            ready(i);
+            return;
+        }
+        boost::system::error_code ignored;
+        link.socket.close(ignored);
+
+        tcp::resolver resolver(io_context);
+        boost::system::error_code ec;
+        auto results = resolver.resolve(link.endpoint.host, link.endpoint.port, ec);
+        if (ec) {
+            finish(i, ec.message());
+            return;
+        }
+        boost::asio::async_connect(link.socket, results,
+            [this, i](const boost::system::error_code &ec, const tcp::endpoint &) {
+                if (ec) {
+                    finish(i, ec.message());
+                    return;
+                }
+                ready(i);
+            });
+    }
+
+    /**
+     * @brief  Starts writing the query and reading the reply on an open connection.
+     */
+    void ready(size_t i) {
+        Link &link = *links[i];
+        if (link.done) {
+            return;
+        }
+        link.connected = true;
+        write_next(i);
+        read_chunk(i);
+    }
+
+    /**
+     * @brief  Writes the next queued query chunk to a data holder.
+     */
+    void write_next(size_t i) {
+        Link &link = *links[i];
+        if (link.done || !link.connected || link.writing || link.outbox.empty()) {
+            return;
+        }
+        link.writing = true;
+        // Every data holder writes the same buffer; nothing is re-serialized. The
+        // handler holds the chunk, since finish() may empty the queue meanwhile.
+        QueryChunk chunk = link.outbox.front();
+        boost::asio::async_write(link.socket, boost::asio::buffer(*chunk),
+            [this, i, chunk](const boost::system::error_code &ec, size_t) {
+                Link &link = *links[i];
+                link.writing = false;
+                if (link.done) {
+                    return;
+                }
+                if (ec) {
+                    finish(i, ec.message());
+                    return;
+                }
+                WireChunkHeader header;
+                std::memcpy(&header, chunk->data(), sizeof(header));
+                link.sent = header.count == 0;
+                link.outbox.pop_front();
+                write_next(i);
+                read_query();
+            });
+    }
+
+    /**
+     * @brief  Returns whether some data holder has a full write queue.
+     */
+    bool backlogged() const {
+        for (const std::unique_ptr<Link> &link : links) {
+            if (!link->done && link->outbox.size() >= max_queued_chunks) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * @brief  Queues a query chunk to every data holder still in the batch.
+     */
+    void forward(const QueryChunk &chunk) {
+        for (size_t i = 0; i < links.size(); i++) {
+            if (!links[i]->done) {
+                links[i]->outbox.push_back(chunk);
+                write_next(i);
+            }
+        }
+    }
+
+    /**
+     * @brief  Reads the next query chunk from upstream, unless a read is already in
+     *         flight, the query is over, or a data holder's queue is full.
+     * @note   The query must be made of fixed-width residues mod N from here on, and
+     *         must hold exactly the elements its parameters announce.
+     */
+    void read_query() {
+        if (reading || query_read || query_failed || backlogged()) {
+            return;
+        }
+        if (std::all_of(links.begin(), links.end(), [](const std::unique_ptr<Link> &link) { return link->done; })) {
+            return; // Nobody is left to forward to; run() reports the query as unread.
+        }
+        reading = true;
+        boost::asio::async_read(*upstream, boost::asio::buffer(&query_header, sizeof(query_header)),
+            [this](const boost::system::error_code &ec, size_t) {
+                if (ec) {
+                    reading = false;
+                    fail_query(ec);
+                    return;
+                }
+                const WireChunkHeader header = query_header;
+                try {
+                    if (header.count == 0) {
+                        if (header.length != 0) {
+                            throw std::runtime_error("malformed end chunk");
+                        }
+                        if (query_received != query_elements) {
+                            throw std::runtime_error("the query ends before all its filters");
+                        }
+                    } else {
+                        wire_check_header(header);
+                        if (header.width != modulus->width()) {
+                            throw std::runtime_error("query ciphertexts must have " + std::to_string(modulus->width()) + " limbs");
+                        }
+                        if (header.count > query_elements - query_received) {
+                            throw std::runtime_error("the query holds more elements than its parameters announce");
+                        }
+                    }
+                } catch (std::exception &e) {
+                    reading = false;
+                    fail_query(e.what());
+                    return;
+                }
+
+                std::shared_ptr<std::vector<uint8_t>> chunk = std::make_shared<std::vector<uint8_t>>(sizeof(header) + header.length);
+                std::memcpy(chunk->data(), &header, sizeof(header));
+                if (header.count == 0) {
+                    reading = false;
+                    query_read = true;
+                    forward(chunk);
+                    return;
+                }
+                boost::asio::async_read(*upstream, boost::asio::buffer(chunk->data() + sizeof(header), header.length),
+                    [this, chunk, header](const boost::system::error_code &ec, size_t) {
+                        reading = false;
+                        if (ec) {
+                            fail_query(ec);
+                            return;
+                        }
+                        query_received += header.count;
+                        forward(chunk);
+                        read_query();
+                    });
+            });
+    }
+
+    /**
+     * @brief  Ends the batch after the upstream connection failed.
+     */
+    void fail_query(const boost::system::error_code &ec) {
+        if (ec == boost::asio::error::operation_aborted) {
+            return; // Cancelled by finish() once every data holder was done.
+        }
+        fail_query(ec.message());
+    }
+
+    /**
+     * @brief  Ends the batch after the query turned out to be malformed or incomplete.
+     * @note   Every data holder holds part of a query it can never complete, so all
+     *         connections are closed.
+     */
+    void fail_query(const std::string &error) {
+        std::cerr << "Error: Forwarding the query failed: " << error << "\n";
+        query_failed = true;
+        for (size_t i = 0; i < links.size(); i++) {
+            finish(i, "the query was cut off");
+        }
+    }
+
+    /**
+     * @brief  Reads the next chunk of a data holder's reply.
+     */
+    void read_chunk(size_t i) {
+        Link &link = *links[i];
+        boost::asio::async_read(link.socket, boost::asio::buffer(&link.header, sizeof(link.header)),
+            [this, i](const boost::system::error_code &ec, size_t) {
+                if (ec) {
+                    finish(i, ec.message());
+                    return;
+                }
+                Link &link = *links[i];
+                if (link.header.count == 0) {
+                    complete(i);
+                    return;
+                }
+                try {
+                    wire_check_header(link.header);
+                } catch (std::exception &e) {
+                    finish(i, e.what());
+                    return;
+                }
+                link.payload.resize((link.header.length + sizeof(mp_limb_t) - 1) / sizeof(mp_limb_t));
+                boost::asio::async_read(link.socket, boost::asio::buffer(link.payload.data(), link.header.length),
+                    [this, i](const boost::system::error_code &ec, size_t) {
+                        if (ec) {
+                            finish(i, ec.message());
+                            return;
+                        }
+                        if (accumulate(i)) {
+                            read_chunk(i);
+                        }
+                    });
+            });
+    }
+
+    /**
+     * @brief  Decodes one chunk of a data holder's reply and adds it to the partial sum.
+     * @note   The reply is [P][S][Q] followed by the P sketches of each query in turn;
+     *         the sketches are summed while the rest of the reply is still in flight.
+     *         Chunks are folded on the thread running the io_context; only the merge
+     *         of a complete reply into the aggregate is split across the workers.
+     * @return Whether the reply is still valid.
+     */
+    bool accumulate(size_t i) {
+        Link &link = *links[i];
+        const WireChunkHeader &header = link.header;
+        const size_t count = static_cast<size_t>(header.count);
+
+        if (link.received < REPLY_HEADER_SIZE) {
+            // The plaintext reply header; it always comes in variable-width chunks.
+            link.chunk.clear();
+            try {
+                if (header.width != 0) {
+                    throw std::runtime_error("reply header must be plaintext");
+                }
+                wire_decode_chunk(reinterpret_cast<const uint8_t *>(link.payload.data()), header, link.chunk);
+            } catch (std::exception &e) {
+                finish(i, e.what());
+                return false;
+            }
+            for (const mpz_class &value : link.chunk) {
+                const uint64_t k = link.received++;
+                if (k == REPLY_PROVIDERS) {
+                    link.providers = value.get_si();
+                } else if (k == REPLY_SKETCH_LENGTH) {
+                    link.sketch_length = value.get_si();
+                } else if (k == REPLY_BATCH_SIZE) {
+                    if (value != batch_size) {
+                        finish(i, "reply does not cover the batch");
+                        return false;
+                    }
+                } else {
+                    finish(i, "sketch entries must be fixed-width residues");
+                    return false;
+                }
+            }
+            if (link.received == REPLY_HEADER_SIZE) {
+                // The header decides what this center allocates, so it is bounded before use:
+                // P by a per-child limit, S by the first reply's S, and the partial sums
+                // by a memory budget. Nothing here may throw into the io_context.
+                if (link.providers <= 0 || link.providers > max_reply_providers ||
+                    link.sketch_length <= 0 || link.sketch_length > max_sketch_length) {
+                    finish(i, "invalid reply header");
+                    return false;
+                }
+                if (expected_sketch_length == 0) {
+                    expected_sketch_length = link.sketch_length;
+                } else if (link.sketch_length != expected_sketch_length) {
+                    finish(i, "sketch length differs from the other data holders");
+                    return false;
+                }
+                const uint64_t slots = static_cast<uint64_t>(batch_size) * static_cast<uint64_t>(link.sketch_length);
+                if (slots * (modulus->width() + 1) * sizeof(mp_limb_t) > max_partial_bytes) {
+                    finish(i, "invalid reply header");
+                    return false;
+                }
+                // Initialize every sum to E(0), which is 0 in this scheme.
+                try {
+                    link.partial = CiphertextAccumulator(slots, modulus->width());
+                } catch (std::exception &e) {
+                    finish(i, e.what());
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        if (header.width != modulus->width()) {
+            finish(i, "sketch entries must be residues of " + std::to_string(modulus->width()) + " limbs");
+            return false;
+        }
+        const uint64_t first = link.received - REPLY_HEADER_SIZE;
+        // The header bounds keep these products far below 2^64.
+        const uint64_t query_entries = static_cast<uint64_t>(link.providers) * static_cast<uint64_t>(link.sketch_length);
+        if (first + count > static_cast<uint64_t>(batch_size) * query_entries) {
+            finish(i, "reply holds more sketch entries than announced");
+            return false;
+        }
+        // Aggregate homomorphically by adding the corresponding encrypted elements,
+        // straight from the received limbs. The sums are only bounded if every
+        // entry is a canonical residue, so anything else is rejected.
+        for (size_t e = 0; e < count; e++) {
+            const mp_limb_t *entry = link.payload.data() + e * header.width;
+            if (mpn_cmp(entry, modulus->limbs(), header.width) >= 0) {
+                finish(i, "sketch entry is not reduced mod N");
+                return false;
+            }
+            // Entry k belongs to query k / (P * S) and bucket k % S.
+            const uint64_t k = first + e;
+            link.partial.add((k / query_entries) * link.sketch_length + k % link.sketch_length, entry, *modulus);
+        }
+        link.received += count;
+        return true;
+    }
+
+    /**
+     * @brief  Adds a fully received reply to the aggregate.
+     * @note   Partial sums only reach the aggregate once the whole reply has arrived,
+     *         so a data holder that fails mid-reply leaves the aggregate untouched.
+     */
+    void complete(size_t i) {
+        Link &link = *links[i];
+        if (link.header.length != 0) {
+            finish(i, "malformed end chunk");
+            return;
+        }
+        if (link.received < REPLY_HEADER_SIZE ||
+            link.received != REPLY_HEADER_SIZE + static_cast<uint64_t>(batch_size) *
+                                 static_cast<uint64_t>(link.providers) * static_cast<uint64_t>(link.sketch_length)) {
+            finish(i, "received sketch size does not match the reply header");
+            return;
+        }
+        if (lc_sketch_agg.size() == 0) {
+            lc_sketch_agg = std::move(link.partial);
+        } else if (lc_sketch_agg.size() != link.partial.size()) {
+            finish(i, "sketch length differs from the other data holders");
+            return;
+        } else {
+            // Buckets are independent, so the merge is split into bucket ranges across the workers.
+            parallel_for(static_cast<int>(lc_sketch_agg.size()), workers, [&](int, int begin, int end) {
+                lc_sketch_agg.add(link.partial, begin, end, *modulus);
+            });
+        }
+        link.partial = CiphertextAccumulator();
+        responded++;
+        sketch_total += static_cast<int>(link.providers);
+        finish(i, "");
+    }
+
+    /**
+     * @brief  Ends the exchange with one data holder.
+     * @param  i      The data holder.
+     * @param  error  Empty on success, otherwise the reason it is left out.
+     */
+    void finish(size_t i, const std::string &error) {
+        Link &link = *links[i];
+        if (link.done) {
+            return;
+        }
+        link.done = true;
+        link.timer.cancel();
+        link.outbox.clear();
+        if (!error.empty() || !link.sent) {
+            // The connection may be anywhere in a message, so it cannot carry another.
+            boost::system::error_code ignored;
+            link.socket.close(ignored);
+        }
+
+        if (error.empty()) {
+            std::cout << "Aggregated sketches from data holder " << link.endpoint.host << ":" << link.endpoint.port << ".\n";
+        } else {
+            std::cerr << "Data holder " << link.endpoint.host << ":" << link.endpoint.port << " left out: " << error << "\n";
+        }
+
+        if (std::all_of(links.begin(), links.end(), [](const std::unique_ptr<Link> &link) { return link->done; })) {
+            // The rest of the query has nowhere to go, and would keep run() waiting.
+            if (reading) {
+                boost::system::error_code ignored;
+                upstream->cancel(ignored);
+            }
+        } else {
+            read_query(); // This data holder's queue no longer holds the others back.
+        }
+    }
+
+    boost::asio::io_context &io_context;
+    std::chrono::milliseconds timeout;
+    tcp::socket *upstream = nullptr;  ///< The connection the current query arrives on.
+    const Modulus *modulus = nullptr; ///< The modulus of the current batch.
+    long batch_size = 1;
+    int workers;
+    std::vector<std::unique_ptr<Link>> links;
+    WireChunkHeader query_header;     ///< The header of the query chunk being read.
+    uint64_t query_elements = 0;      ///< The elements the current query announces.
+    uint64_t query_received = 0;      ///< The query elements read so far.
+    bool reading = false;             ///< Whether an upstream read is in flight.
+    bool query_read = false;          ///< Whether the end chunk of the query was read.
+    bool query_failed = false;        ///< Whether the query was cut off or malformed.
+    CiphertextAccumulator lc_sketch_agg;
+    int responded = 0;
+    int sketch_total = 0;
+    long expected_sketch_length = 0; ///< S of the first valid reply header; the others must match.
+};
 
 
 /**
- * @brief  Receives and deserializes a vector of mpz_class numbers from a TCP socket.
- * @note   This function reads data according to the custom binary protocol defined
- *         in send_multiple_mpz_class.
- * @param  socket  The active Boost.Asio TCP socket.
- * @return A vector containing the received mpz_class numbers.
+ * @struct AggregationOptions
+ * @brief  The command-line settings of a center.
  */
-std::vector<mpz_class> receive_multiple_mpz_class(tcp::socket &socket) {
-    uint32_t total_length;
-    boost::asio::read(socket, boost::asio::buffer(&total_length, sizeof(total_length)));
+struct AggregationOptions {
+    std::vector<DataHolderEndpoint> data_holders; ///< The children: data holders or relays.
+    long timeout_ms = 60000;
+    int min_responses = 0;
+    int workers = 1;
+    bool relay = false; ///< Answer the parent with partial sketches instead of blinding them.
+};
 
-    std::vector<uint8_t> buffer(total_length);
-    boost::asio::read(socket, boost::asio::buffer(buffer));
 
-    std::vector<mpz_class> numbers;
-    size_t offset = 0;
+/// The largest Bloom filter a query may announce, as for the data holders.
+static const long max_query_filter_size = 1 << 24;
 
-    while (offset < buffer.size()) {
-        uint32_t len;
-        std::memcpy(&len, buffer.data() + offset, sizeof(len));
-        offset += sizeof(len);
 
-        mpz_class num;
-        mpz_import(num.get_mpz_t(), len, 1, 1, 1, 0, buffer.data() + offset);
-        offset += len;
+/**
+ * @brief  Reads the chunks of a query that carry its plaintext parameters.
+ * @note   The parameters are few and come first, so this reads a handful of small
+ *         chunks; the ciphertexts that follow are left on the connection.
+ * @param  upstream    The connection of the client or of the parent center.
+ * @param  head        Output: the chunks read, to be forwarded as they are.
+ * @param  parameters  Output: the decoded parameters, QUERY_E0_1 of them.
+ * @throws boost::system::system_error with eof if the peer closed the connection
+ *         instead of sending a query, std::runtime_error if the head is malformed.
+ */
+void read_query_head(tcp::socket &upstream, std::vector<QueryChunk> &head, std::vector<mpz_class> &parameters) {
+    while (parameters.size() < QUERY_E0_1) {
+        WireChunkHeader header;
+        boost::system::error_code ec;
+        boost::asio::read(upstream, boost::asio::buffer(&header, sizeof(header)), ec);
+        if (ec == boost::asio::error::eof && head.empty()) {
+            throw boost::system::system_error(ec); // A clean close between batches.
+        }
+        if (ec) {
+            throw std::runtime_error("the query was cut off: " + ec.message());
+        }
+        if (header.count == 0) {
+            throw std::runtime_error("the query ends before its parameters");
+        }
+        wire_check_header(header);
+        if (header.width != 0) {
+            throw std::runtime_error("the query parameters must be plaintext");
+        }
+
+        std::shared_ptr<std::vector<uint8_t>> chunk = std::make_shared<std::vector<uint8_t>>(sizeof(header) + header.length);
+        std::memcpy(chunk->data(), &header, sizeof(header));
+        boost::asio::read(upstream, boost::asio::buffer(chunk->data() + sizeof(header), header.length), ec);
+        if (ec) {
+            throw std::runtime_error("the query was cut off: " + ec.message());
+        }
+        wire_decode_chunk(chunk->data() + sizeof(header), header, parameters);
+        head.push_back(chunk);
+    }
+    if (parameters.size() != QUERY_E0_1) {
+        throw std::runtime_error("the query parameters run into its ciphertexts");
+    }
+}
+
+
+/**
+ * @brief  Answers one batch of queries arriving on a connection.
+ * @note   A root center blinds and shuffles the aggregate and sends the client one
+ *         sketch per query. A relay sends its parent [1][S][Q] and then, query by
+ *         query, the unblinded sum of its children's sketches, i.e. it looks like a
+ *         data holder with a single provider. Blinding and shuffling are left to the
+ *         root: shuffling at a relay would misalign the buckets of different subtrees.
+ *         A relay that cannot answer closes the connection without replying, so its
+ *         parent leaves it out like any failed data holder.
+ * @param  upstream    The connection of the client or of the parent center.
+ * @param  options     The center's settings.
+ * @param  fan_out     The links to the children, kept open across batches.
+ * @return 0 on success, 1 if the query was rejected or too few children answered.
+ */
+int serve_query(tcp::socket &upstream, const AggregationOptions &options, SketchFanOut &fan_out) {
+    // --- Step 2: Receive and Forward Query ---
+    // Read the plaintext parameters at the front of the query. The CA only needs
+    // the public modulus N, the batch size Q and the filter size m from them; the
+    // query is kept in its wire encoding and forwarded as is.
+    std::vector<QueryChunk> head;
+    std::vector<mpz_class> query_parameters;
+    try {
+        read_query_head(upstream, head, query_parameters);
+    } catch (boost::system::system_error &) {
+        throw;
+    } catch (std::runtime_error &e) {
+        std::cerr << "Error: " << e.what() << ".\n";
+        return 1;
+    }
+    const mpz_class &N = query_parameters[QUERY_MODULUS];
+    if (mpz_sgn(N.get_mpz_t()) <= 0 || mpz_even_p(N.get_mpz_t()) || mpz_size(N.get_mpz_t()) > WIRE_MAX_WIDTH) {
+        std::cerr << "Error: The query does not carry a valid public modulus.\n";
+        return 1;
+    }
+    const mpz_class &announced_batch_size = query_parameters[QUERY_BATCH_SIZE];
+    if (announced_batch_size < 1 || announced_batch_size > QUERY_MAX_BATCH_SIZE) {
+        std::cerr << "Error: Unsupported batch size " << announced_batch_size << ".\n";
+        return 1;
+    }
+    const mpz_class &filter_size = query_parameters[QUERY_FILTER_SIZE];
+    if (filter_size < 1 || filter_size > max_query_filter_size) {
+        std::cerr << "Error: Unsupported Bloom filter size " << filter_size << ".\n";
+        return 1;
+    }
+    const long batch_size = announced_batch_size.get_si();
+    const Modulus pk_N(N);
+    // The query is two E(0) and a BFx and a BFy of m entries per query; with Q and m
+    // bounded this is far below 2^64, and nothing beyond it is forwarded.
+    const uint64_t query_elements = QUERY_HEADER_SIZE +
+        2 * static_cast<uint64_t>(batch_size) * static_cast<uint64_t>(filter_size.get_si());
+    std::cout << "Received a batch of " << batch_size << " encrypted queries from "
+              << (options.relay ? "the parent center" : "client") << ".\n";
+
+    // --- Step 3: Fan Out and Aggregate Sketches ---
+    // Each chunk of the query is written to every child as soon as it is read
+    // from upstream. Each reply is aggregated homomorphically chunk by chunk as
+    // it arrives.
+    const std::vector<DataHolderEndpoint> &data_holders = options.data_holders;
+    if (!fan_out.run(upstream, head, query_parameters.size(), query_elements, pk_N, batch_size)) {
+        std::cerr << "Error: The query was not received in full.\n";
+        return 1;
+    }
 
-        numbers.emplace_back(std::move(num));
+    if (fan_out.responses() < options.min_responses || fan_out.responses() == 0) {
+        std::cerr << "Error: Only " << fan_out.responses() << " of " << data_holders.size()
+                  << " data holders answered (" << options.min_responses << " required).\n";
+        return 1;
+    }
+    CiphertextAccumulator &lc_sketch_agg = fan_out.aggregate();
+    const size_t sketch_length = fan_out.sketch_length();
+    // A relay answers like a single provider, so behind relays this counts child sketches.
+    std::cout << "Homomorphically aggregated " << fan_out.sketches() << " sketches per query from "
+              << fan_out.responses() << " of " << data_holders.size() << " children.\n";
+
+    if (options.relay) {
+        // --- Step 3b: Forward the Partial Sketches ---
+        // The sums are reduced per bucket range across the workers and sent upstream.
+        CiphertextVector partial_sketch(lc_sketch_agg.size(), lc_sketch_agg.width());
+        parallel_for(static_cast<int>(lc_sketch_agg.size()), options.workers, [&](int, int begin, int end) {
+            for (int b = begin; b < end; b++) {
+                lc_sketch_agg.store(b, partial_sketch[b], pk_N);
+            }
+        });
+        MpzStreamWriter writer(upstream);
+        writer.write(mpz_class(1));
+        writer.write(mpz_class(static_cast<unsigned long>(sketch_length)));
+        writer.write(mpz_class(batch_size));
+        writer.write_limbs(partial_sketch.data(), partial_sketch.size(), partial_sketch.width());
+        writer.finish();
+        std::cout << "Sent partial sketches to the parent center.\n";
+        return 0;
     }
 
-    return numbers;
+    // --- Step 3b: Apply Privacy Enhancements ---
+    // Multiply each element of the aggregated sketch by an encrypted random number
+    // to further blind the result before sending it back to the client, and shuffle
+    // each query's privatized sketch to hide the positional information of the bits.
+    // NOTE: This step's cryptographic purpose needs to be clearly defined by the protocol.
+    // Each worker draws from its thread's own ChaCha20 stream, seeded from
+    // std::random_device, so the stage runs in parallel without sharing a generator.
+    const int workers = options.workers;
+
+    // The permutations of all queries are drawn up front, one query per task:
+    // order[first + b] is the bucket that lands at position b of its query's sketch.
+    std::vector<size_t> order(lc_sketch_agg.size());
+    parallel_for(static_cast<int>(batch_size), workers, [&](int, int begin, int end) {
+        RandomStream &stream = RandomStream::thread_instance();
+        for (int query = begin; query < end; query++) {
+            const size_t first = query * sketch_length;
+            std::iota(order.begin() + first, order.begin() + first + sketch_length, first);
+            std::shuffle(order.begin() + first, order.begin() + first + sketch_length, stream);
+        }
+    });
+
+    // One pass over bucket ranges blinds each bucket and writes its canonical residue
+    // straight into its shuffled position; no unshuffled copy is ever made.
+    CiphertextVector private_lc_sketch(lc_sketch_agg.size(), lc_sketch_agg.width());
+    parallel_for(static_cast<int>(lc_sketch_agg.size()), workers, [&](int, int begin, int end) {
+        RandomStream &stream = RandomStream::thread_instance();
+        std::uniform_int_distribution<> blinding_factor(1, 100);
+        for (int b = begin; b < end; b++) {
+            lc_sketch_agg.mul_ui(order[b], blinding_factor(stream), pk_N);
+            lc_sketch_agg.store(order[b], private_lc_sketch[b], pk_N);
+        }
+    });
+    std::cout << "Applied privacy enhancements (blinding and shuffling).\n";
+
+    // --- Send Final Result to Client ---
+    MpzStreamWriter writer(upstream);
+    writer.write_limbs(private_lc_sketch.data(), private_lc_sketch.size(), private_lc_sketch.width());
+    writer.finish();
+    std::cout << "Sent final processed sketches to client.\n";
+    return 0;
 }
 
+
 /**
- * @brief  Generates a random integer within a specified range.
- * @param  lowerBound The lower bound of the range (inclusive).
- * @param  upperBound The upper bound of the range (inclusive).
- * @return A random integer.
+ * @brief  Answers batches arriving on one connection until the peer closes it.
+ * @param  upstream  The connection of the client or of the parent center.
+ * @param  options   The center's settings.
+ * @param  fan_out   The links to the children, kept open across batches.
+ * @return 0 once the peer has closed the connection between batches, otherwise
+ *         the status of the batch that could not be answered.
  */
-int generateRandomNumber(int lowerBound, int upperBound) {
-    // Define the distribution for the random numbers.
-    std::uniform_int_distribution<> RandomNumber(lowerBound, upperBound);
-    // Generate and return an integer using the global static engine.
-    return RandomNumber(gen);
+int serve_connection(tcp::socket &upstream, const AggregationOptions &options, SketchFanOut &fan_out) {
+    for (;;) {
+        int status;
+        try {
+            status = serve_query(upstream, options, fan_out);
+        } catch (boost::system::system_error &e) {
+            if (e.code() == boost::asio::error::eof) {
+                return 0;
+            }
+            throw;
+        }
+        if (status != 0) {
+            return status;
+        }
+    }
 }
 
 
@@ -117,86 +860,94 @@ int generateRandomNumber(int lowerBound, int upperBound) {
  */
 int main(int argc, char *argv[]) {
     // --- Argument Parsing ---
-    if (argc != 4) {
-        std::cerr << "Usage: " << argv[0] << " <listen_port> <data_holder_ip> <data_holder_port>\n";
+    // <listen_port> is followed by one (ip, port) pair per child (a data holder or
+    // a relay) and optionally by --timeout-ms <ms>, --min-responses <count>,
+    // --workers <count> and --relay.
+    std::vector<std::string> args(argv + 1, argv + argc);
+    AggregationOptions options;
+    options.workers = default_worker_count();
+    int min_responses = -1; // By default every data holder must answer.
+    std::string listen_port;
+    bool usage_error = args.empty();
+
+    std::vector<std::string> positional;
+    try {
+        for (size_t i = 0; i < args.size() && !usage_error; i++) {
+            if (args[i] == "--timeout-ms" && i + 1 < args.size()) {
+                options.timeout_ms = std::stol(args[++i]);
+            } else if (args[i] == "--min-responses" && i + 1 < args.size()) {
+                min_responses = std::stoi(args[++i]);
+            } else if (args[i] == "--workers" && i + 1 < args.size()) {
+                options.workers = std::max(1, std::stoi(args[++i]));
+            } else if (args[i] == "--relay") {
+                options.relay = true;
+            } else if (args[i].rfind("--", 0) == 0) {
+                usage_error = true;
+            } else {
+                positional.push_back(args[i]);
+            }
+        }
+    } catch (std::logic_error &) {
+        // A malformed number is a usage error rather than an uncaught exception.
+        usage_error = true;
+    }
+    if (positional.size() < 3 || positional.size() % 2 == 0) {
+        usage_error = true;
+    }
+    if (usage_error) {
+        std::cerr << "Usage: " << argv[0] << " <listen_port> <data_holder_ip> <data_holder_port>"
+                  << " [<data_holder_ip> <data_holder_port> ...] [--timeout-ms <ms>] [--min-responses <count>]"
+                  << " [--workers <count>] [--relay]\n";
         return 1;
     }
-    std::string listen_port = argv[1];
-    std::string data_holder_ip = argv[2];
-    std::string data_holder_port = argv[3];
+    listen_port = positional[0];
+    for (size_t i = 1; i + 1 < positional.size(); i += 2) {
+        options.data_holders.push_back({positional[i], positional[i + 1]});
+    }
+    if (min_responses < 0 || min_responses > static_cast<int>(options.data_holders.size())) {
+        min_responses = static_cast<int>(options.data_holders.size());
+    }
+    options.min_responses = min_responses;
 
     try {
         boost::asio::io_context io_context;
 
         // --- Step 1: Network Setup ---
-        // Create an acceptor to listen for incoming connections from the client.
+        // Create an acceptor to listen for incoming connections from the client,
+        // or, for a relay, from the parent center.
         tcp::acceptor acceptor(io_context, tcp::endpoint(tcp::v4(), std::stoi(listen_port)));
-        std::cout << "Center server listening on port " << listen_port << "...\n";
-        tcp::socket client_socket(io_context);
-        acceptor.accept(client_socket);
-        std::cout << "Client connected.\n";
-
-        // Create a socket to connect to the downstream data holder server.
-        tcp::resolver resolver(io_context);
-        tcp::socket data_holder_socket(io_context);
-        boost::asio::connect(data_holder_socket, resolver.resolve(data_holder_ip, data_holder_port));
-        std::cout << "Connected to data holder at " << data_holder_ip << ":" << data_holder_port << ".\n";
-
-        // --- Step 2: Receive and Forward Query ---
-        // Receive the encrypted query payload from the client.
-        std::vector<mpz_class> query_from_client = receive_multiple_mpz_class(client_socket);
-        std::cout << "Received encrypted query from client.\n";
-
-        // Forward the entire payload to the data holder server.
-        send_multiple_mpz_class(data_holder_socket, query_from_client);
-        std::cout << "Forwarded query to data holder.\n";
-
-        // --- Step 3: Receive and Process Results ---
-        // Receive the concatenated encrypted Linear Counting sketches from the data holder.
-        std::vector<mpz_class> lc_sketches_holder = receive_multiple_mpz_class(data_holder_socket);
-        std::cout << "Received encrypted sketches from data holders.\n";
-       
-        // --- Step 3a: Aggregate Sketches ---
-        // The protocol assumes a fixed number of data providers and that the received
-        // vector is a concatenation of their individual sketches.
-        int server_number = 4; // This should ideally be a parameter or dynamically determined.
-        if (lc_sketches_holder.size() % server_number != 0) {
-             std::cerr << "Error: Received sketch size is not divisible by the number of providers.\n";
-             return 1;
-        }
-        int lc_length = lc_sketches_holder.size() / server_number;
-        std::vector<mpz_class> lc_sketch_agg(lc_length);
-
-        // Aggregate the sketches homomorphically by adding the corresponding encrypted elements.
-        for (int i = 0; i < lc_length; i++) {
-            lc_sketch_agg[i] = 0; // Initialize sum to E(0) which is 0 in this scheme.
-            for (int j = 0; j < server_number; j++) {
-                lc_sketch_agg[i] += lc_sketches_holder[i + j * lc_length];
-            }
+        std::cout << (options.relay ? "Relay center" : "Center server") << " listening on port " << listen_port << "...\n";
+
+        // The children are connected on the first batch and the connections are
+        // reused by every later one.
+        SketchFanOut fan_out(io_context, options.data_holders, std::chrono::milliseconds(options.timeout_ms),
+                             options.workers);
+
+        if (!options.relay) {
+            tcp::socket client_socket(io_context);
+            acceptor.accept(client_socket);
+            std::cout << "Client connected.\n";
+            // The client may send any number of batches in turn; it closes the
+            // connection when it is done.
+            return serve_connection(client_socket, options, fan_out);
         }
-        std::cout << "Homomorphically aggregated sketches.\n";
 
-        // --- Step 3b: Apply Privacy Enhancements ---
-        // Multiply each element of the aggregated sketch by an encrypted random number
-        // to further blind the result before sending it back to the client.
-        // NOTE: This step's cryptographic purpose needs to be clearly defined by the protocol.
-        std::vector<mpz_class> private_lc_sketch;
-        for (mpz_class& mpz : lc_sketch_agg) {
-            private_lc_sketch.push_back(mpz * generateRandomNumber(1, 100));
+        // A relay keeps serving its parent until it is stopped. The parent sends
+        // any number of batches per connection, and reconnects after a failure.
+        for (;;) {
+            tcp::socket parent_socket(io_context);
+            acceptor.accept(parent_socket);
+            try {
+                serve_connection(parent_socket, options, fan_out);
+            } catch (std::exception &e) {
+                std::cerr << "Exception while relaying a query: " << e.what() << std::endl;
+            }
         }
 
-        // Shuffle the privatized sketch to hide the positional information of the bits.
-        std::shuffle(private_lc_sketch.begin(), private_lc_sketch.end(), gen);
-        std::cout << "Applied privacy enhancements (blinding and shuffling).\n";
-        
-        // --- Send Final Result to Client ---
-        send_multiple_mpz_class(client_socket, private_lc_sketch);
-        std::cout << "Sent final processed sketch to client.\n";
-
     } catch (std::exception &e) {
         std::cerr << "Exception: " << e.what() << std::endl;
         return 1; // Return an error code on exception.
     }
 
     return 0;
-}
\ No newline at end of file
+}
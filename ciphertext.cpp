@@ -0,0 +1,280 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  ciphertext.cpp
+ *
+ *    Description:  Implementation of flat ciphertext storage.
+ *
+ *        Version:  1.0
+ *
+ * =====================================================================================
+ */
+
+#include "ciphertext.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+/**
+ * @brief  Returns this thread's scratch limbs, grown to at least `size`.
+ * @note   One buffer per thread keeps the kernels allocation-free once warm
+ *         and safe to call from parallel_for workers.
+ */
+static mp_limb_t *scratch_limbs(size_t size) {
+    thread_local std::vector<mp_limb_t> scratch;
+    if (scratch.size() < size) {
+        scratch.resize(size);
+    }
+    return scratch.data();
+}
+
+/**
+ * @brief  Wraps a public modulus.
+ * @param  N  The modulus; must be positive and odd (N = pq).
+ */
+Modulus::Modulus(const mpz_class &N) : N(N), limb_width(mpz_size(N.get_mpz_t())) {
+    if (mpz_sgn(N.get_mpz_t()) <= 0 || mpz_even_p(N.get_mpz_t())) {
+        throw std::invalid_argument("modulus must be positive and odd");
+    }
+
+    // Newton's iteration doubles the correct low bits of N^-1 mod 2^64 each
+    // step; n0 is its own inverse mod 8, so five steps give all 64.
+    const mp_limb_t n0 = limbs()[0];
+    mp_limb_t inverse = n0;
+    for (int step = 0; step < 5; step++) {
+        inverse *= 2 - n0 * inverse;
+    }
+    n_inverse = -inverse;
+}
+
+/**
+ * @brief  Returns R^e mod N, where R = 2^(64 * width()).
+ */
+mpz_class Modulus::radix_power(unsigned e) const {
+    mpz_class power;
+    mpz_setbit(power.get_mpz_t(), static_cast<mp_bitcnt_t>(GMP_NUMB_BITS) * limb_width * e);
+    mpz_mod(power.get_mpz_t(), power.get_mpz_t(), N.get_mpz_t());
+    return power;
+}
+
+/**
+ * @brief  Allocates `count` zero residues of `width` limbs.
+ */
+CiphertextVector::CiphertextVector(size_t count, size_t width) {
+    assign(count, width);
+}
+
+/**
+ * @brief  Resizes to `count` residues of `width` limbs, all zero.
+ */
+void CiphertextVector::assign(size_t count, size_t width) {
+    this->count = count;
+    limb_width = width;
+    limbs.assign(count * width, 0);
+}
+
+/**
+ * @brief  Returns a read-only mpz view of residue i.
+ */
+mpz_srcptr CiphertextVector::view(size_t i, __mpz_struct &storage) const {
+    // mpz_roinit_n strips the zero padding, so the view has its true size.
+    return mpz_roinit_n(&storage, (*this)[i], static_cast<mp_size_t>(limb_width));
+}
+
+/**
+ * @brief  Copies residue i into a GMP integer.
+ */
+void CiphertextVector::get(size_t i, mpz_class &out) const {
+    __mpz_struct storage;
+    mpz_set(out.get_mpz_t(), view(i, storage));
+}
+
+/**
+ * @brief  Stores value mod N as residue i.
+ */
+void CiphertextVector::set_mod(size_t i, mpz_srcptr value, const Modulus &modulus) {
+    mp_limb_t *dst = (*this)[i];
+    const size_t w = limb_width;
+    const size_t size = mpz_size(value);
+    if (size < w) {
+        std::memcpy(dst, mpz_limbs_read(value), size * sizeof(mp_limb_t));
+        std::fill(dst + size, dst + w, 0);
+        return;
+    }
+    mp_limb_t *quotient = scratch_limbs(size - w + 1);
+    mpn_tdiv_qr(quotient, dst, 0, mpz_limbs_read(value), size, modulus.limbs(), w);
+}
+
+/**
+ * @brief  Copies w limbs into residue i.
+ */
+void CiphertextVector::set(size_t i, const mp_limb_t *value) {
+    std::memcpy((*this)[i], value, limb_width * sizeof(mp_limb_t));
+}
+
+/**
+ * @brief  Residue i = a * b mod N.
+ */
+void CiphertextVector::mul_mod(size_t i, const mp_limb_t *a, const mp_limb_t *b, const Modulus &modulus) {
+    const size_t w = limb_width;
+    // The double-width product and the quotient live in the thread's scratch,
+    // so the result can overwrite an operand.
+    mp_limb_t *product = scratch_limbs(3 * w + 1);
+    mp_limb_t *quotient = product + 2 * w;
+    if (a == b) {
+        mpn_sqr(product, a, w);
+    } else {
+        mpn_mul_n(product, a, b, w);
+    }
+    mpn_tdiv_qr(quotient, (*this)[i], 0, product, 2 * w, modulus.limbs(), w);
+}
+
+/**
+ * @brief  Residue i = a * b * R^-1 mod N.
+ */
+void CiphertextVector::mont_mul(size_t i, const mp_limb_t *a, const mp_limb_t *b, const Modulus &modulus) {
+    const size_t w = limb_width;
+    const mp_limb_t *n = modulus.limbs();
+    const mp_limb_t n_inverse = modulus.inverse();
+    mp_limb_t *product = scratch_limbs(2 * w);
+    if (a == b) {
+        mpn_sqr(product, a, w);
+    } else {
+        mpn_mul_n(product, a, b, w);
+    }
+
+    // Montgomery reduction: adding m * N with m = product[j] * -N^-1 clears limb j.
+    // The cleared limb is free to hold the carry out of the pass, and those carries
+    // are added back in one go at the end.
+    for (size_t j = 0; j < w; j++) {
+        product[j] = mpn_addmul_1(product + j, n, w, product[j] * n_inverse);
+    }
+    mp_limb_t *dst = (*this)[i];
+    // The product is below N^2 < N * R, so the result is below 2N.
+    mp_limb_t carry = mpn_add_n(dst, product + w, product, w);
+    if (carry || mpn_cmp(dst, n, w) >= 0) {
+        mpn_sub_n(dst, dst, n, w);
+    }
+}
+
+/**
+ * @brief  Residue i = residue i * r mod N for a small factor r.
+ */
+void CiphertextVector::mul_ui_mod(size_t i, unsigned long r, const Modulus &modulus) {
+    const size_t w = limb_width;
+    mp_limb_t *product = scratch_limbs(w + 3);
+    mp_limb_t *quotient = product + w + 1;
+    product[w] = mpn_mul_1(product, (*this)[i], w, r);
+    mpn_tdiv_qr(quotient, (*this)[i], 0, product, w + 1, modulus.limbs(), w);
+}
+
+/**
+ * @brief  Residue i = residue i + a mod N.
+ * @note   Both operands are below N, so one conditional subtraction reduces the sum.
+ */
+void CiphertextVector::add_mod(size_t i, const mp_limb_t *a, const Modulus &modulus) {
+    const size_t w = limb_width;
+    mp_limb_t *dst = (*this)[i];
+    mp_limb_t carry = mpn_add_n(dst, dst, a, w);
+    if (carry || mpn_cmp(dst, modulus.limbs(), w) >= 0) {
+        mpn_sub_n(dst, dst, modulus.limbs(), w);
+    }
+}
+
+/**
+ * @brief  Allocates `count` zero slots for residues of `width` limbs.
+ */
+CiphertextAccumulator::CiphertextAccumulator(size_t count, size_t width, uint64_t max_bound)
+    : limb_width(width), bound_limit(std::min<uint64_t>(std::max<uint64_t>(max_bound, 1), 1ull << 63)),
+      bounds(count, 1), limbs(count * (width + 1), 0) {
+}
+
+/**
+ * @brief  Sets slot i to a residue.
+ */
+void CiphertextAccumulator::set(size_t i, const mp_limb_t *residue) {
+    mp_limb_t *dst = slot(i);
+    std::memcpy(dst, residue, limb_width * sizeof(mp_limb_t));
+    dst[limb_width] = 0;
+    bounds[i] = 1;
+}
+
+/**
+ * @brief  Makes room in slot i for `growth` more multiples of N.
+ * @note   The bound never passes 2^64, and value < 2^64 * N < 2^64 * R fits in
+ *         the w + 1 limbs of a slot, so the operations below cannot overflow.
+ */
+void CiphertextAccumulator::reserve(size_t i, uint64_t growth, const Modulus &modulus) {
+    if (bounds[i] > bound_limit - std::min(growth, bound_limit)) {
+        reduce(i, modulus);
+    }
+}
+
+/**
+ * @brief  Slot i += residue * r.
+ */
+void CiphertextAccumulator::addmul_ui(size_t i, const mp_limb_t *residue, unsigned long r, const Modulus &modulus) {
+    reserve(i, r, modulus);
+    mp_limb_t *dst = slot(i);
+    mp_limb_t carry = (r == 1) ? mpn_add_n(dst, dst, residue, limb_width)
+                               : mpn_addmul_1(dst, residue, limb_width, r);
+    dst[limb_width] += carry;
+    bounds[i] += r;
+    if (bounds[i] > bound_limit) {
+        reduce(i, modulus);
+    }
+}
+
+/**
+ * @brief  Adds slots [begin, end) of another accumulator of the same size to this one.
+ */
+void CiphertextAccumulator::add(const CiphertextAccumulator &other, size_t begin, size_t end, const Modulus &modulus) {
+    if (other.size() != size() || other.width() != width() || begin > end || end > size()) {
+        throw std::invalid_argument("accumulators differ in size");
+    }
+    for (size_t i = begin; i < end; i++) {
+        reserve(i, other.bounds[i], modulus);
+        mpn_add_n(slot(i), slot(i), other.slot(i), limb_width + 1);
+        bounds[i] += other.bounds[i];
+        if (bounds[i] > bound_limit) {
+            reduce(i, modulus);
+        }
+    }
+}
+
+/**
+ * @brief  Slot i *= r.
+ */
+void CiphertextAccumulator::mul_ui(size_t i, unsigned long r, const Modulus &modulus) {
+    if (r != 0 && bounds[i] > bound_limit / r) {
+        reduce(i, modulus);
+    }
+    mpn_mul_1(slot(i), slot(i), limb_width + 1, r);
+    bounds[i] = std::max<uint64_t>(bounds[i] * r, 1);
+    if (bounds[i] > bound_limit) {
+        reduce(i, modulus);
+    }
+}
+
+/**
+ * @brief  Reduces slot i mod N in place.
+ */
+void CiphertextAccumulator::reduce(size_t i, const Modulus &modulus) {
+    if (bounds[i] == 1) {
+        return; // Already a residue.
+    }
+    mp_limb_t *dst = slot(i);
+    mp_limb_t *quotient = scratch_limbs(2);
+    // mpn_tdiv_qr may write the remainder over the dividend.
+    mpn_tdiv_qr(quotient, dst, 0, dst, limb_width + 1, modulus.limbs(), limb_width);
+    dst[limb_width] = 0;
+    bounds[i] = 1;
+}
+
+/**
+ * @brief  Writes the canonical residue of slot i to `out`.
+ */
+void CiphertextAccumulator::store(size_t i, mp_limb_t *out, const Modulus &modulus) {
+    reduce(i, modulus);
+    std::memcpy(out, slot(i), limb_width * sizeof(mp_limb_t));
+}
@@ -0,0 +1,255 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  ciphertext.h
+ *
+ *    Description:  Public interface for flat ciphertext storage. Ciphertexts of
+ *                  the SHE scheme are residues mod N, so a vector of them is kept
+ *                  as one contiguous arena of fixed-width limb arrays and operated
+ *                  on in place with GMP's mpn layer, instead of as one heap
+ *                  allocated mpz_class per ciphertext.
+ *
+ *        Version:  1.0
+ *
+ * =====================================================================================
+ */
+
+#ifndef CIPHERTEXT_H
+#define CIPHERTEXT_H
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <gmpxx.h>
+
+/**
+ * @brief  The default bound, as a multiple of N, up to which a CiphertextAccumulator
+ *         slot grows before it is reduced.
+ * @note   1 reduces after every operation. Larger bounds reduce less often; the slot
+ *         width does not depend on the bound.
+ */
+#define CIPHERTEXT_LAZY_BOUND (1ull << 32)
+
+/**
+ * @class Modulus
+ * @brief The public modulus N, in the limb form the residue kernels use.
+ */
+class Modulus {
+public:
+    /**
+     * @brief  Wraps a public modulus.
+     * @param  N  The modulus; must be positive.
+     * @throws std::invalid_argument if N is not positive and odd.
+     */
+    explicit Modulus(const mpz_class &N);
+
+    /// The number of limbs of N, which is the width of every residue.
+    size_t width() const { return limb_width; }
+
+    /// The limbs of N, least significant first.
+    const mp_limb_t *limbs() const { return mpz_limbs_read(N.get_mpz_t()); }
+
+    /// N as a GMP integer.
+    const mpz_class &value() const { return N; }
+
+    /// -N^-1 mod 2^64, the per-limb factor of Montgomery reduction.
+    mp_limb_t inverse() const { return n_inverse; }
+
+    /**
+     * @brief  Returns R^e mod N, where R = 2^(64 * width()) is the Montgomery radix.
+     * @note   Used to cancel the R^-1 factors that CiphertextVector::mont_mul() leaves.
+     */
+    mpz_class radix_power(unsigned e) const;
+
+private:
+    mpz_class N;
+    size_t limb_width;
+    mp_limb_t n_inverse;
+};
+
+/**
+ * @class CiphertextVector
+ * @brief A vector of residues mod N stored contiguously, `width` limbs each.
+ *
+ * Element i occupies limbs [i * width, (i + 1) * width), least significant limb
+ * first and zero-padded, which is both GMP's mpn layout and the fixed-width wire
+ * layout, so a whole vector can be read from or written to a socket as is.
+ * The arena is allocated once; the modular operations below work in place and
+ * never allocate (their scratch space is per thread), and every result is
+ * reduced, so the footprint is exactly size() * width() limbs.
+ *
+ * The operations expect their operands to be residues, i.e. less than N.
+ */
+class CiphertextVector {
+public:
+    CiphertextVector() = default;
+
+    /**
+     * @brief  Allocates `count` zero residues of `width` limbs.
+     */
+    CiphertextVector(size_t count, size_t width);
+
+    /**
+     * @brief  Resizes to `count` residues of `width` limbs, all zero.
+     */
+    void assign(size_t count, size_t width);
+
+    /// The number of residues.
+    size_t size() const { return count; }
+
+    /// The number of limbs per residue.
+    size_t width() const { return limb_width; }
+
+    /// The whole arena.
+    mp_limb_t *data() { return limbs.data(); }
+    const mp_limb_t *data() const { return limbs.data(); }
+
+    /// The limbs of residue i.
+    mp_limb_t *operator[](size_t i) { return limbs.data() + i * limb_width; }
+    const mp_limb_t *operator[](size_t i) const { return limbs.data() + i * limb_width; }
+
+    /**
+     * @brief  Returns a read-only mpz view of residue i, valid while the vector is unchanged.
+     * @param  i        The residue.
+     * @param  storage  The struct that holds the view.
+     */
+    mpz_srcptr view(size_t i, __mpz_struct &storage) const;
+
+    /**
+     * @brief  Copies residue i into a GMP integer.
+     */
+    void get(size_t i, mpz_class &out) const;
+
+    /**
+     * @brief  Stores value mod N as residue i.
+     * @param  value  Any non-negative integer.
+     */
+    void set_mod(size_t i, mpz_srcptr value, const Modulus &modulus);
+
+    /**
+     * @brief  Copies w limbs into residue i.
+     */
+    void set(size_t i, const mp_limb_t *value);
+
+    /**
+     * @brief  Residue i = a * b mod N. `a` or `b` may be residue i itself.
+     */
+    void mul_mod(size_t i, const mp_limb_t *a, const mp_limb_t *b, const Modulus &modulus);
+
+    /**
+     * @brief  Residue i = a * b * R^-1 mod N, the Montgomery product.
+     * @note   The reduction runs one multiply-accumulate pass per limb instead of a
+     *         long division, so it is cheaper than mul_mod(). It needs no conversion
+     *         into Montgomery form: a chain of products just picks up one R^-1 per
+     *         multiplication, which the caller cancels with a single factor from
+     *         Modulus::radix_power(). `a` or `b` may be residue i itself.
+     */
+    void mont_mul(size_t i, const mp_limb_t *a, const mp_limb_t *b, const Modulus &modulus);
+
+    /**
+     * @brief  Residue i = residue i * r mod N for a small factor r.
+     */
+    void mul_ui_mod(size_t i, unsigned long r, const Modulus &modulus);
+
+    /**
+     * @brief  Residue i = residue i + a mod N.
+     */
+    void add_mod(size_t i, const mp_limb_t *a, const Modulus &modulus);
+
+private:
+    size_t count = 0;
+    size_t limb_width = 0;
+    std::vector<mp_limb_t> limbs;
+};
+
+/**
+ * @class CiphertextAccumulator
+ * @brief Sums of residues mod N that are reduced only when needed.
+ *
+ * Homomorphic sums and blinding factors only need their result mod N, so the
+ * intermediate values need not be reduced after every step. Each slot has one
+ * headroom limb above the width of N. The accumulator tracks a bound `b` for
+ * each slot with value < b * N. Additions and small multiplications just grow
+ * the bound. A slot is reduced, with one division, only when its bound would
+ * pass max_bound() or when its residue is read with store(). Whatever leaves
+ * the accumulator is therefore a canonical residue.
+ *
+ * Every operand passed in must be a residue, i.e. less than N.
+ */
+class CiphertextAccumulator {
+public:
+    CiphertextAccumulator() = default;
+
+    /**
+     * @brief  Allocates `count` zero slots for residues of `width` limbs.
+     * @param  max_bound  The bound at which a slot is reduced, clamped to [1, 2^63].
+     */
+    CiphertextAccumulator(size_t count, size_t width, uint64_t max_bound = CIPHERTEXT_LAZY_BOUND);
+
+    /// The number of slots.
+    size_t size() const { return bounds.size(); }
+
+    /// The number of limbs of the residues (each slot has one more).
+    size_t width() const { return limb_width; }
+
+    /// The bound at which a slot is reduced.
+    uint64_t max_bound() const { return bound_limit; }
+
+    /**
+     * @brief  Sets slot i to a residue.
+     */
+    void set(size_t i, const mp_limb_t *residue);
+
+    /**
+     * @brief  Slot i += residue * r, for a small factor r.
+     */
+    void addmul_ui(size_t i, const mp_limb_t *residue, unsigned long r, const Modulus &modulus);
+
+    /**
+     * @brief  Slot i += residue.
+     */
+    void add(size_t i, const mp_limb_t *residue, const Modulus &modulus) { addmul_ui(i, residue, 1, modulus); }
+
+    /**
+     * @brief  Adds every slot of another accumulator of the same size to this one.
+     */
+    void add(const CiphertextAccumulator &other, const Modulus &modulus) { add(other, 0, size(), modulus); }
+
+    /**
+     * @brief  Adds slots [begin, end) of another accumulator of the same size to this one.
+     * @note   Slots are independent, so calls on disjoint ranges may run concurrently.
+     */
+    void add(const CiphertextAccumulator &other, size_t begin, size_t end, const Modulus &modulus);
+
+    /**
+     * @brief  Slot i *= r, for a small factor r.
+     */
+    void mul_ui(size_t i, unsigned long r, const Modulus &modulus);
+
+    /**
+     * @brief  Reduces slot i mod N in place.
+     */
+    void reduce(size_t i, const Modulus &modulus);
+
+    /**
+     * @brief  Writes the canonical residue of slot i, `width()` limbs, to `out`.
+     */
+    void store(size_t i, mp_limb_t *out, const Modulus &modulus);
+
+private:
+    /// The limbs of slot i.
+    mp_limb_t *slot(size_t i) { return limbs.data() + i * (limb_width + 1); }
+    const mp_limb_t *slot(size_t i) const { return limbs.data() + i * (limb_width + 1); }
+
+    /**
+     * @brief  Makes room in slot i for `growth` more multiples of N.
+     */
+    void reserve(size_t i, uint64_t growth, const Modulus &modulus);
+
+    size_t limb_width = 0;
+    uint64_t bound_limit = 1;
+    std::vector<uint64_t> bounds; ///< For each slot, a b with value < b * N.
+    std::vector<mp_limb_t> limbs;
+};
+
+#endif // CIPHERTEXT_H
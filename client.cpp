@@ -17,112 +17,25 @@
 #include <iostream>
 #include <vector>
 #include <chrono>
+#include <algorithm>
+#include <utility>
+#include <memory>
+#include <stdexcept>
 #include <gmpxx.h>
 #include "bloomfilter.h"
 #include "linearcounting.h" // Note: This header is included but the class is not directly used.
 #include "SHE.h"
-#include "MurmurHash3.h"
+#include "parallel.h"
+#include "querytemplate.h"
+#include "dyadic.h"
+#include "wire.h"
 
 using boost::asio::ip::tcp;
 
-/**
- * @brief  A local reimplementation of a hash function.
- * @note   This appears to be a duplicate of the hash_result function from bloomfilter.cpp.
- *         Consolidating such functions into a shared utility file is recommended.
- * @param  data_id  The integer data to hash.
- * @param  length   The range for the modulo operation.
- * @param  seed     The seed for the hash function.
- * @return The resulting hash value, mapped to the range [0, length-1].
- */
-int hashr(int data_id, int length, int seed) {
-    uint32_t hash_result;
-    std::string key = std::to_string(data_id) + "|" + std::to_string(length);
-    MurmurHash3_x86_32(key.c_str(), key.size(), seed, &hash_result);
-    return hash_result % length;
-}
-
-/**
- * @brief  Serializes and sends a vector of mpz_class numbers over a TCP socket.
- * @note   This function implements a custom binary protocol:
- *         1. A 4-byte header with the total buffer length is sent first.
- *         2. The main buffer follows, containing a sequence of numbers.
- *         3. Each number is encoded as [4-byte length][binary data].
- * @param  socket   The active Boost.Asio TCP socket.
- * @param  numbers  A constant reference to the vector of mpz_class to send.
- */
-void send_multiple_mpz_class(tcp::socket &socket, const std::vector<mpz_class> &numbers) {
-    std::vector<uint8_t> buffer;
-
-    // Pre-allocate buffer space to improve performance by reducing reallocations.
-    // Estimated average size of 520 bytes per number.
-    buffer.reserve(numbers.size() * 520);
-
-    for (const auto &num : numbers) {
-        // Export the mpz_class to a raw binary format.
-        size_t count = 0;
-        void *bin = mpz_export(nullptr, &count, 1, 1, 1, 0, num.get_mpz_t());
-
-        // Append the length of the binary data (as a 4-byte integer).
-        uint32_t len = static_cast<uint32_t>(count);
-        uint8_t *len_ptr = reinterpret_cast<uint8_t *>(&len);
-        buffer.insert(buffer.end(), len_ptr, len_ptr + sizeof(len));
-        
-        // Append the binary data itself.
-        buffer.insert(buffer.end(), reinterpret_cast<uint8_t *>(bin), reinterpret_cast<uint8_t *>(bin) + len);
-
-        // Free the temporary buffer allocated by mpz_export.
-        free(bin);
-    }
-
-    // Send the total size of the constructed buffer.
-    uint32_t total_length = static_cast<uint32_t>(buffer.size());
-    boost::asio::write(socket, boost::asio::buffer(&total_length, sizeof(total_length)));
-    
-    // Send the buffer itself.
-    boost::asio::write(socket, boost::asio::buffer(buffer));
-}
-
-/**
- * @brief  Receives and deserializes a vector of mpz_class numbers from a TCP socket.
- * @note   This function reads data according to the custom binary protocol defined
- *         in send_multiple_mpz_class.
- * @param  socket  The active Boost.Asio TCP socket.
- * @return A vector containing the received mpz_class numbers.
- */
-std::vector<mpz_class> receive_multiple_mpz_class(tcp::socket &socket) {
-    // Read the total length of the incoming buffer.
-    uint32_t total_length;
-    boost::asio::read(socket, boost::asio::buffer(&total_length, sizeof(total_length)));
-
-    // Read the entire data buffer based on the received length.
-    std::vector<uint8_t> buffer(total_length);
-    boost::asio::read(socket, boost::asio::buffer(buffer));
-
-    std::vector<mpz_class> numbers;
-    size_t offset = 0;
-
-    // Parse the buffer by iteratively reading [length][data] chunks.
-    while (offset < buffer.size()) {
-        // Read the 4-byte length of the next number.
-        uint32_t len;
-        std::memcpy(&len, buffer.data() + offset, sizeof(len));
-        offset += sizeof(len);
-
-        // Import the binary data into a new mpz_class object.
-        mpz_class num;
-        mpz_import(num.get_mpz_t(), len, 1, 1, 1, 0, buffer.data() + offset);
-        offset += len;
-
-        numbers.emplace_back(std::move(num));
-    }
-
-    return numbers;
-}
-
 /**
  * @brief  Sends a single mpz_class number as a string.
  * @deprecated This string-based serialization is less efficient than the binary format
- *             used in send_multiple_mpz_class. Recommended for debugging only.
+ *             used in send_multiple_mpz_class (wire.h). Recommended for debugging only.
  */
 void send_mpz_class(tcp::socket &socket, const mpz_class &number) {
     std::string data = number.get_str();
@@ -143,17 +56,54 @@ mpz_class receive_mpz_class(tcp::socket &socket) {
     return mpz_class(std::string(buffer.begin(), buffer.end()));
 }
 
+/**
+ * @brief  Returns the true count of a range [a, b) x [c, d) on the data holders'
+ *         built-in synthetic data.
+ * @note   That data (see server.cpp) holds the diagonal points (v, v) for v in
+ *         [0, 2193): four providers of 2190 points each, shifted by 0 to 3. The
+ *         count is only the true one if the data holders serve neither --dataset
+ *         nor --csv; the client cannot tell.
+ */
+int synthetic_range_count(int a, int b, int c, int d) {
+    const int synthetic_end = 2190 + 3;
+    const int low = std::max({a, c, 0});
+    const int high = std::min({b, d, synthetic_end});
+    return std::max(high - low, 0);
+}
+
 /**
  * @brief  Main entry point for the client application.
  */
 int main(int argc, char *argv[]) {
     // --- Argument Parsing ---
-    if (argc != 3) {
-        std::cerr << "Usage: " << argv[0] << " <server_ip> <port>\n";
+    if (argc < 3 || argc > 5) {
+        std::cerr << "Usage: " << argv[0] << " <server_ip> <port> [batch_size] [rounds]\n";
         return 1;
     }
     std::string server_ip = argv[1];
     std::string port = argv[2];
+    // The number of range queries sent together in one message.
+    int batch_size = 1;
+    // The number of times the batch is sent over the connection.
+    int rounds = 1;
+    try {
+        if (argc >= 4) {
+            batch_size = std::stoi(argv[3]);
+        }
+        if (argc == 5) {
+            rounds = std::stoi(argv[4]);
+        }
+    } catch (std::logic_error &) {
+        rounds = 0;
+    }
+    if (rounds < 1) {
+        std::cerr << "Usage: " << argv[0] << " <server_ip> <port> [batch_size] [rounds]\n";
+        return 1;
+    }
+    if (batch_size < 1 || batch_size > QUERY_MAX_BATCH_SIZE) {
+        std::cerr << "Error: The batch size must be between 1 and " << QUERY_MAX_BATCH_SIZE << ".\n";
+        return 1;
+    }
 
     try {
         // --- Network Setup ---
@@ -162,24 +112,7 @@ int main(int argc, char *argv[]) {
         tcp::resolver resolver(io_context);
         boost::asio::connect(socket, resolver.resolve(server_ip, port));
         
-        auto total_start_time = std::chrono::high_resolution_clock::now();
-
-        // --- Step 1: Query Generation (Client-side) ---
-        // Define a 2D query range [a, b] x [c, d].
-        int a = 0, b = 100;
-        int c = 0, d = 100;
-        std::vector<int> range_x, range_y;
-        for (int i = a; i < b; i++) { range_x.push_back(i); }
-        for (int i = c; i < d; i++) { range_y.push_back(i); }
-
-        // Create two Bloom filters to represent the query range and the false positive rate is 0.0001.
-        BloomFilter *bfx = create_bloom_filter(range_x.size(), 0.0001);
-        for (int val : range_x) { bloom_filter_insert(bfx, val); }
-
-        BloomFilter *bfy = create_bloom_filter(range_y.size(), 0.0001);
-        for (int val : range_y) { bloom_filter_insert(bfy, val); }
-        
-        // --- Step 2: Query Encryption ---
+        // --- Offline Phase: Key Setup and Encryption Precomputation ---
         // NOTE: Hardcoded keys are used for this proof-of-concept. In a real
         // system, keys must be managed securely.
         mpz_class p("24949947668204895169844816279817288492414547819866675629196367227690787470169613155592517331436994431290237129971591491697651840834349620997268980480906268395121128743403076738941611756262701100600337509940012574326308548496255602554176656185505317308069007483713003383893987835829101624859098236400325591893987156914330601585661147623846403075246396332268980092371247871842378726521706210349480430847941451750416021497540541325690672019958068418437982341656155182085983628398491651770170518457520016889488745644657092443571740862417400519834822886322713319302563133379081003649775280137182242840819599772353133239557");
@@ -187,65 +120,201 @@ int main(int argc, char *argv[]) {
         mpz_class L("975861485164544069203193");
         SecretKey sk(p, q, L);
 
-        // Prepare the payload to send to the server.
-        std::vector<mpz_class> send_mpz_vector;
-        // Encrypt and add the first Bloom filter.
-        for (int i = 0; i < bfx->size; ++i) {
-            send_mpz_vector.push_back(encrypt(mpz_class(bfx->bits[i]), sk));
-        }
-        // Encrypt and add the second Bloom filter.
-        for (int i = 0; i < bfy->size; ++i) {
-            send_mpz_vector.push_back(encrypt(mpz_class(bfy->bits[i]), sk));
-        }
+        // Every value tested against a filter has a false positive rate of 0.0001.
+        // Set use_blocked_filters to place each element's probes in a single cache line.
+        // Set hash_scheme to HASH_SCHEME_STRING_KEY to reproduce the original string-keyed indices.
+        // Set dyadic_bits to D > 0 to insert each range's dyadic cover instead of its
+        // integers, so filters grow with log(width) rather than width. Data coordinates
+        // outside [0, 2^D) then never match; the sample data fits in 12 bits.
+        const double false_positive_rate = 0.0001;
+        const bool use_blocked_filters = false;
+        const int hash_scheme = HASH_SCHEME_DOUBLE;
+        const int dyadic_bits = 0;
+        // The number of filter elements needed for any range of a given width.
+        auto filter_elements = [&](int width) {
+            return dyadic_bits > 0 ? dyadic_cover_bound(width) : width;
+        };
+        auto filter_geometry = [&](int capacity) {
+            // A data holder tests D + 1 prefixes per value, so each must be rarer.
+            const double rate = false_positive_rate / (dyadic_bits > 0 ? dyadic_bits + 1 : 1);
+            BloomFilter *filter = use_blocked_filters
+                ? create_blocked_bloom_filter(capacity, rate, hash_scheme)
+                : create_bloom_filter(capacity, rate, hash_scheme);
+            if (filter == NULL) {
+                throw std::runtime_error("failed to allocate a Bloom filter");
+            }
+            BloomGeometry geometry = bloom_filter_geometry(filter);
+            destroy_bloom_filter(filter);
+            return geometry;
+        };
+        // The filters of recently used ranges, kept across queries.
+        QueryTemplateCache templates;
+
+        // Precompute encryptions before any query is issued. Users repeat the same
+        // range shape, so the pools of encrypted 0s and 1s are sized for one query
+        // of that shape (100 x 100). Other values, and bits once a pool runs dry,
+        // use pooled masks, which are topped up in the background when they run low.
+        // The precomputation is split across all cores, like the online encryption.
+        const int encryption_workers = default_worker_count();
+        const int expected_width = 100;
+        const size_t offline_masks = 1024;
+        auto offline_start_time = std::chrono::high_resolution_clock::now();
+        std::shared_ptr<const RangeTemplate> shape =
+            templates.get(filter_geometry(filter_elements(expected_width)), dyadic_bits, 0, expected_width);
+        const size_t offline_ones = 2 * shape->ones;
+        const size_t offline_zeros = 2 * (shape->bits.size() - shape->ones) + 2; // Two filters and the two E(0).
+        EncryptionContext enc(sk, offline_masks / 4, offline_masks / 4);
+        enc.precompute_bits(offline_zeros, offline_ones, encryption_workers);
+        enc.precompute(offline_masks, encryption_workers);
+        std::chrono::duration<double> offline_elapsed = std::chrono::high_resolution_clock::now() - offline_start_time;
+        std::cout << "Offline phase: precomputed " << offline_zeros + offline_ones << " encrypted bits and "
+                  << offline_masks << " encryption masks in " << offline_elapsed.count() << " s\n";
+
+        // Every round sends the same batch again over the connection, as a dashboard
+        // refreshing its ranges does, so from the second round on the filters come
+        // from the template cache. Once a round's query is sent, the bit pools and
+        // the mask pool are topped up to their offline size in the background while
+        // the client waits for the reply. A round that starts before the top-up is
+        // done encrypts the missing bits inline, and its total time includes that.
+        for (int round = 0; round < rounds; round++) {
+            if (round > 0) {
+                std::cout << "Round " << round + 1 << ": the pools hold " << enc.available_bits(0) + enc.available_bits(1)
+                          << " of " << offline_zeros + offline_ones << " encrypted bits and " << enc.available()
+                          << " of " << offline_masks << " masks, topped up in the background.\n";
+            }
 
-        // Append encrypted auxiliary values for the server-side protocol.
-        send_mpz_vector.push_back(encrypt(mpz_class("0"), sk)); // E(0)
-        send_mpz_vector.push_back(encrypt(mpz_class("0"), sk)); // E(0)
-        
-        // Append the public modulus N, which is the public key for the SHE scheme.
-        send_mpz_vector.push_back(sk.N);
+            auto total_start_time = std::chrono::high_resolution_clock::now();
 
-        // --- Step 3: Send Encrypted Query to Server ---
-        send_multiple_mpz_class(socket, send_mpz_vector);
-        
-        // --- Step 4: Receive Encrypted Result from Server ---
-        std::vector<mpz_class> receive_mpz_vector = receive_multiple_mpz_class(socket);
-        
-        // --- Step 5: Decrypt Result and Estimate Cardinality from Decrypted Sketch ---
-        std::vector<mpz_class> LC_sketch_decrypted;
-        for (const mpz_class& mpz : receive_mpz_vector) {
-            LC_sketch_decrypted.push_back(decrypt(mpz, sk));
-        }
+            // --- Step 1: Query Generation (Client-side) ---
+            // Define the 2D query ranges [a, b) x [c, d). The first is [0, 100) x [0, 100);
+            // further queries of a batch slide it along the diagonal of the sample data.
+            struct RangeQuery { int a, b, c, d; };
+            std::vector<RangeQuery> queries;
+            for (int q = 0; q < batch_size; q++) {
+                int offset = (q * 100) % 2000;
+                queries.push_back({offset, offset + 100, offset, offset + 100});
+            }
 
-        double zero_bits_count = 0;
-        int lc_length = LC_sketch_decrypted.size();
-        for (int i = 0; i < lc_length; i++) {
-            if (LC_sketch_decrypted[i] == 0) {
-                zero_bits_count++;
+            // Represent each query's range by two Bloom filters, taken from the template
+            // cache when the same range was used before. All filters of a batch share one
+            // geometry, sized for the largest range.
+            int capacity = 1;
+            for (const RangeQuery &query : queries) {
+                capacity = std::max({capacity, filter_elements(query.b - query.a), filter_elements(query.d - query.c)});
+            }
+            const BloomGeometry geometry = filter_geometry(capacity);
+            std::vector<std::shared_ptr<const RangeTemplate>> bfx(batch_size), bfy(batch_size);
+            for (int q = 0; q < batch_size; q++) {
+                bfx[q] = templates.get(geometry, dyadic_bits, queries[q].a, queries[q].b);
+                bfy[q] = templates.get(geometry, dyadic_bits, queries[q].c, queries[q].d);
             }
-        }
-        
-        // Apply the standard Linear Counting estimator: -S * log(S' / S)
-        int estimated_count = 0;
-        if (zero_bits_count > 0) { // Avoid log(0)
-            estimated_count = std::floor(-lc_length * log(zero_bits_count / static_cast<double>(lc_length)));
-        } else {
-             // If there are no zero bits, the sketch is saturated.
-             // The estimation is unreliable, but we can report the sketch size as a lower bound.
-            estimated_count = lc_length;
-        }
 
-        // --- Final Output ---
-        std::cout << "The true range count is: " << 100 << " \n"; 
-        std::cout << "The estimated range count is: " << estimated_count << " \n";
+            // --- Step 2 & 3: Encrypt the Queries and Stream them to the Server ---
+            // The batch is written chunk by chunk while it is being encrypted, so the
+            // server starts receiving (and evaluating) before encryption has finished.
+            MpzStreamWriter writer(socket);
+
+            // The plaintext filter parameters lead the query so the data holders can
+            // reproduce the probe positions up front. All filters share one geometry.
+            writer.write(mpz_class(geometry.hash_count));
+            writer.write(mpz_class(geometry.blocked));
+            writer.write(mpz_class(geometry.hash_scheme));
+            writer.write(mpz_class(dyadic_bits));
+            writer.write(mpz_class(geometry.size));
+            // The public modulus N, which is the public key for the SHE scheme.
+            writer.write(sk.N);
+            writer.write(mpz_class(batch_size));
+
+            // Every ciphertext is a residue mod N and travels as mpz_size(N) limbs.
+            const size_t width = mpz_size(sk.N.get_mpz_t());
+
+            // The plaintexts in message order: the two encrypted auxiliary values E(0)
+            // shared by the batch, then the bits of each query's two Bloom filters.
+            std::vector<uint8_t> plaintexts = { 0, 0 };
+            for (int q = 0; q < batch_size; q++) {
+                plaintexts.insert(plaintexts.end(), bfx[q]->bits.begin(), bfx[q]->bits.end());
+                plaintexts.insert(plaintexts.end(), bfy[q]->bits.begin(), bfy[q]->bits.end());
+            }
+
+            // Encrypt the plaintexts, mostly by taking ready ciphertexts from the bit pools,
+            // one wire chunk per block on all cores, and write each block as soon as it and
+            // every block before it are done. Encryption thus overlaps with the transfer,
+            // and the first chunk leaves after one block.
+            const int window = 4 * encryption_workers;
+            const size_t block_size = WIRE_CHUNK_ELEMENTS;
+            const int blocks = static_cast<int>((plaintexts.size() + block_size - 1) / block_size);
+            std::vector<std::vector<mpz_class>> slots(window, std::vector<mpz_class>(block_size));
+            auto block_range = [&](int block) {
+                size_t begin = static_cast<size_t>(block) * block_size;
+                return std::make_pair(begin, std::min(plaintexts.size(), begin + block_size));
+            };
+            parallel_pipeline(blocks, encryption_workers, window,
+                [&](int, int block) {
+                    auto [begin, end] = block_range(block);
+                    std::vector<mpz_class> &slot = slots[block % window];
+                    for (size_t i = begin; i < end; i++) {
+                        slot[i - begin] = enc.encrypt_bit(plaintexts[i]);
+                    }
+                },
+                [&](int block) {
+                    auto [begin, end] = block_range(block);
+                    writer.write_fixed(slots[block % window].data(), end - begin, width);
+                });
+            writer.finish();
+            if (round + 1 < rounds) {
+                enc.top_up_async(offline_masks, offline_zeros, offline_ones);
+            }
 
-        auto total_end_time = std::chrono::high_resolution_clock::now();
-        std::chrono::duration<double> total_elapsed = total_end_time - total_start_time;
-        std::cout << "The total time: " << total_elapsed.count() << " s\n";
+            // --- Step 4: Receive Encrypted Result from Server ---
+            // One sketch per query, in batch order.
+            std::vector<mpz_class> receive_mpz_vector = receive_multiple_mpz_class(socket);
+            if (receive_mpz_vector.empty() || receive_mpz_vector.size() % batch_size != 0) {
+                throw std::runtime_error("the reply does not hold one sketch per query");
+            }
+            const int lc_length = static_cast<int>(receive_mpz_vector.size() / batch_size);
+
+            // --- Step 5: Decrypt Result and Estimate Cardinality from Decrypted Sketch ---
+            // Only the number of zero buckets matters, so the sketch is tested for
+            // zero plaintexts in a batch without materialising the decrypted values.
+            BatchDecryptor decryptor(sk, default_worker_count());
+            for (int q = 0; q < batch_size; q++) {
+                std::vector<mpz_class> sketch(receive_mpz_vector.begin() + static_cast<size_t>(q) * lc_length,
+                                              receive_mpz_vector.begin() + static_cast<size_t>(q + 1) * lc_length);
+                double zero_bits_count = decryptor.count_zeros(sketch);
+
+                // Apply the standard Linear Counting estimator: -S * log(S' / S)
+                int estimated_count = 0;
+                if (zero_bits_count > 0) { // Avoid log(0)
+                    estimated_count = std::floor(-lc_length * log(zero_bits_count / static_cast<double>(lc_length)));
+                } else {
+                     // If there are no zero bits, the sketch is saturated.
+                     // The estimation is unreliable, but we can report the sketch size as a lower bound.
+                    estimated_count = lc_length;
+                }
+
+                // --- Final Output ---
+                if (batch_size > 1) {
+                    std::cout << "Query " << q + 1 << ": [" << queries[q].a << ", " << queries[q].b << ") x ["
+                              << queries[q].c << ", " << queries[q].d << ")\n";
+                }
+                std::cout << "The true range count is: "
+                          << synthetic_range_count(queries[q].a, queries[q].b, queries[q].c, queries[q].d)
+                          << " (on the built-in synthetic data)\n";
+                std::cout << "The estimated range count is: " << estimated_count << " \n";
+            }
 
-        // Clean up dynamically allocated Bloom filters.
-        destroy_bloom_filter(bfx);
-        destroy_bloom_filter(bfy);
+            auto total_end_time = std::chrono::high_resolution_clock::now();
+            std::chrono::duration<double> total_elapsed = total_end_time - total_start_time;
+            if (round == 0) {
+                std::cout << "The total time: " << total_elapsed.count() << " s ("
+                          << offline_elapsed.count() + total_elapsed.count() << " s with the offline phase)\n";
+            } else {
+                std::cout << "The total time: " << total_elapsed.count() << " s\n";
+            }
+        }
+        if (rounds > 1) {
+            std::cout << "Template cache: " << templates.hits() << " hits, " << templates.misses() << " misses.\n";
+        }
 
     } catch (std::exception &e) {
         std::cerr << "Exception: " << e.what() << std::endl;
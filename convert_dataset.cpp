@@ -0,0 +1,84 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  convert_dataset.cpp
+ *
+ *    Description:  Converts a quantized CSV dataset into the binary columnar
+ *                  file that data holders map at startup. The conversion runs
+ *                  once per dataset; data holders never parse CSV.
+ *
+ *        Version:  1.0
+ *
+ * =====================================================================================
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+#include "dataset.h"
+#include "parallel.h"
+
+/**
+ * @brief  Main entry point for the dataset converter.
+ */
+int main(int argc, char *argv[]) {
+    // --- Argument Parsing ---
+    // <input.csv> <output.bin> [providers] [--fraction <f>] [--seed <s>] [--workers <n>]
+    std::vector<std::string> args(argv + 1, argv + argc);
+    std::vector<std::string> positional;
+    double fraction = 0;   // 0: contiguous partitions instead of sampling.
+    uint64_t seed = 0;
+    int workers = default_worker_count();
+    bool usage_error = false;
+    // The number of provider partitions the records are split into.
+    int providers = 1;
+    try {
+        for (size_t i = 0; i < args.size() && !usage_error; i++) {
+            if (args[i] == "--fraction" && i + 1 < args.size()) {
+                fraction = std::stod(args[++i]);
+            } else if (args[i] == "--seed" && i + 1 < args.size()) {
+                seed = std::stoull(args[++i]);
+            } else if (args[i] == "--workers" && i + 1 < args.size()) {
+                workers = std::stoi(args[++i]);
+            } else if (args[i].rfind("--", 0) == 0) {
+                usage_error = true;
+            } else {
+                positional.push_back(args[i]);
+            }
+        }
+        if (positional.size() == 3) {
+            providers = std::stoi(positional[2]);
+        }
+    } catch (std::logic_error &) {
+        // A malformed number is a usage error rather than an uncaught exception.
+        usage_error = true;
+    }
+    if (usage_error || positional.size() < 2 || positional.size() > 3 || providers < 1 || workers < 1 ||
+        fraction < 0 || fraction > 1) {
+        std::cerr << "Usage: " << argv[0] << " <input.csv> <output.bin> [providers]"
+                  << " [--fraction <f>] [--seed <s>] [--workers <n>]\n";
+        return 1;
+    }
+    std::string input = positional[0];
+    std::string output = positional[1];
+
+    try {
+        auto start_time = std::chrono::high_resolution_clock::now();
+        // With --fraction every provider samples that fraction of the whole file
+        // independently (seeded by seed + provider); otherwise the file is split.
+        Dataset dataset = (fraction > 0)
+            ? Dataset::sample(Dataset::read_csv(input, 1, workers), providers, fraction, seed, workers)
+            : Dataset::read_csv(input, providers, workers);
+        dataset.save(output);
+        auto end_time = std::chrono::high_resolution_clock::now();
+        std::chrono::duration<double> elapsed = end_time - start_time;
+        std::cout << "Converted " << dataset.size() << " records into " << dataset.providers()
+                  << " provider partitions in " << elapsed.count() << " s: " << output << "\n";
+    } catch (std::exception &e) {
+        std::cerr << "Exception: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,412 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  dataset.cpp
+ *
+ *    Description:  Implementation of the data holder's dataset subsystem.
+ *
+ *        Version:  1.0
+ *
+ * =====================================================================================
+ */
+
+#include "dataset.h"
+#include "parallel.h"
+#include <algorithm>
+#include <charconv>
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <utility>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * @brief  Rounds a byte count up to the 8-byte section alignment.
+ */
+static size_t align8(size_t bytes) {
+    return (bytes + 7) & ~static_cast<size_t>(7);
+}
+
+/**
+ * @struct DatasetSections
+ * @brief  The byte offsets of the sections of a dataset file.
+ */
+struct DatasetSections {
+    size_t offsets, x, y, id, end;
+
+    DatasetSections(uint64_t records, uint64_t providers, bool has_ids) {
+        offsets = align8(sizeof(DatasetFileHeader));
+        x = align8(offsets + (providers + 1) * sizeof(uint64_t));
+        y = align8(x + records * sizeof(int32_t));
+        id = align8(y + records * sizeof(int32_t));
+        end = has_ids ? id + records * sizeof(int64_t) : id;
+    }
+};
+
+/**
+ * @brief  Checks that provider offsets partition [0, records).
+ */
+static bool partitions_valid(const uint64_t *offsets, uint64_t providers, uint64_t records) {
+    if (providers == 0 || offsets[0] != 0 || offsets[providers] != records) {
+        return false;
+    }
+    for (uint64_t p = 0; p < providers; p++) {
+        if (offsets[p] > offsets[p + 1]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+Dataset::~Dataset() {
+    if (mapping) {
+        munmap(mapping, mapping_size);
+    }
+}
+
+Dataset::Dataset(Dataset &&other) noexcept {
+    *this = std::move(other);
+}
+
+Dataset &Dataset::operator=(Dataset &&other) noexcept {
+    if (this == &other) {
+        return *this;
+    }
+    if (mapping) {
+        munmap(mapping, mapping_size);
+    }
+    mapping = other.mapping;
+    mapping_size = other.mapping_size;
+    record_count = other.record_count;
+    provider_count = other.provider_count;
+    owned_offsets = std::move(other.owned_offsets);
+    owned_xs = std::move(other.owned_xs);
+    owned_ys = std::move(other.owned_ys);
+    owned_ids = std::move(other.owned_ids);
+    if (mapping) {
+        offsets = other.offsets;
+        xs = other.xs;
+        ys = other.ys;
+        ids = other.ids;
+    } else {
+        attach_owned();
+    }
+    other.mapping = nullptr;
+    other.mapping_size = 0;
+    other.record_count = 0;
+    other.provider_count = 0;
+    other.offsets = nullptr;
+    other.xs = other.ys = nullptr;
+    other.ids = nullptr;
+    return *this;
+}
+
+/**
+ * @brief  Points the accessors at owned storage.
+ */
+void Dataset::attach_owned() {
+    offsets = owned_offsets.data();
+    xs = owned_xs.data();
+    ys = owned_ys.data();
+    ids = owned_ids.empty() ? nullptr : owned_ids.data();
+}
+
+/**
+ * @brief  Maps a dataset file into memory.
+ * @param  path  The file written by save().
+ */
+Dataset Dataset::map(const std::string &path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("cannot open " + path + ": " + std::strerror(errno));
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(DatasetFileHeader))) {
+        close(fd);
+        throw std::runtime_error(path + " is not a dataset file");
+    }
+    const size_t size = static_cast<size_t>(st.st_size);
+    // A shared read-only mapping: pages come straight from the page cache and are
+    // shared by every process that maps the file.
+    void *mapping = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        throw std::runtime_error("cannot map " + path + ": " + std::strerror(errno));
+    }
+
+    Dataset dataset;
+    dataset.mapping = mapping;
+    dataset.mapping_size = size;
+
+    const uint8_t *base = static_cast<const uint8_t *>(mapping);
+    DatasetFileHeader header;
+    std::memcpy(&header, base, sizeof(header));
+    if (std::memcmp(header.magic, DATASET_MAGIC, sizeof(DATASET_MAGIC)) != 0 || header.version != DATASET_VERSION) {
+        throw std::runtime_error(path + " is not a version " + std::to_string(DATASET_VERSION) + " dataset file");
+    }
+    // Bound the counts before computing section sizes from them.
+    if (header.records > size / (2 * sizeof(int32_t)) || header.providers > size / sizeof(uint64_t)) {
+        throw std::runtime_error(path + " is truncated");
+    }
+    const bool has_ids = (header.flags & DATASET_HAS_IDS) != 0;
+    DatasetSections sections(header.records, header.providers, has_ids);
+    if (sections.end > size) {
+        throw std::runtime_error(path + " is truncated");
+    }
+
+    dataset.record_count = static_cast<size_t>(header.records);
+    dataset.provider_count = static_cast<size_t>(header.providers);
+    dataset.offsets = reinterpret_cast<const uint64_t *>(base + sections.offsets);
+    dataset.xs = reinterpret_cast<const int32_t *>(base + sections.x);
+    dataset.ys = reinterpret_cast<const int32_t *>(base + sections.y);
+    dataset.ids = has_ids ? reinterpret_cast<const int64_t *>(base + sections.id) : nullptr;
+    if (!partitions_valid(dataset.offsets, header.providers, header.records)) {
+        throw std::runtime_error(path + " has invalid provider partitions");
+    }
+    return dataset;
+}
+
+/**
+ * @brief  Wraps columns held in memory.
+ */
+Dataset Dataset::from_columns(std::vector<int32_t> xs, std::vector<int32_t> ys,
+                              std::vector<uint64_t> provider_begin, std::vector<int64_t> ids) {
+    if (xs.size() != ys.size() || (!ids.empty() && ids.size() != xs.size())) {
+        throw std::invalid_argument("dataset columns differ in length");
+    }
+    if (provider_begin.size() < 2 || !partitions_valid(provider_begin.data(), provider_begin.size() - 1, xs.size())) {
+        throw std::invalid_argument("invalid provider partitions");
+    }
+    Dataset dataset;
+    dataset.record_count = xs.size();
+    dataset.provider_count = provider_begin.size() - 1;
+    dataset.owned_offsets = std::move(provider_begin);
+    dataset.owned_xs = std::move(xs);
+    dataset.owned_ys = std::move(ys);
+    dataset.owned_ids = std::move(ids);
+    dataset.attach_owned();
+    return dataset;
+}
+
+/**
+ * @brief  Parses one "id,x,y" row.
+ * @param  p    The start of the row.
+ * @param  end  The end of the row, line terminator excluded.
+ * @return Whether the row is well formed.
+ */
+static bool parse_row(const char *p, const char *end, int64_t &id, int32_t &x, int32_t &y) {
+    auto r = std::from_chars(p, end, id);
+    if (r.ec != std::errc() || r.ptr == end || *r.ptr != ',') {
+        return false;
+    }
+    r = std::from_chars(r.ptr + 1, end, x);
+    if (r.ec != std::errc() || r.ptr == end || *r.ptr != ',') {
+        return false;
+    }
+    r = std::from_chars(r.ptr + 1, end, y);
+    return r.ec == std::errc() && r.ptr == end;
+}
+
+/**
+ * @brief  Reads a quantized CSV file of "id,x,y" rows.
+ */
+Dataset Dataset::read_csv(const std::string &path, int providers, int workers) {
+    if (providers < 1) {
+        throw std::invalid_argument("a dataset needs at least one provider");
+    }
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("cannot open " + path + ": " + std::strerror(errno));
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        throw std::runtime_error("cannot read " + path);
+    }
+    const size_t size = static_cast<size_t>(st.st_size);
+    const char *text = nullptr;
+    if (size > 0) {
+        void *mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping == MAP_FAILED) {
+            close(fd);
+            throw std::runtime_error("cannot map " + path + ": " + std::strerror(errno));
+        }
+        text = static_cast<const char *>(mapping);
+    }
+    close(fd);
+    // Unmaps the CSV on every path out of this function.
+    std::unique_ptr<const char, std::function<void(const char *)>> unmap(text, [size](const char *t) {
+        munmap(const_cast<char *>(t), size);
+    });
+
+    // One byte range per worker, each starting at the beginning of a line.
+    const int chunks = static_cast<int>(std::max<size_t>(1, std::min<size_t>(std::max(1, workers), size / 4096 + 1)));
+    std::vector<size_t> chunk_begin(chunks + 1, size);
+    chunk_begin[0] = 0;
+    for (int c = 1; c < chunks; c++) {
+        size_t at = std::max(chunk_begin[c - 1], size * c / chunks);
+        const void *newline = at < size ? std::memchr(text + at, '\n', size - at) : nullptr;
+        chunk_begin[c] = newline ? static_cast<const char *>(newline) - text + 1 : size;
+    }
+
+    // Pass 1: count the lines of each range, which bounds its rows.
+    std::vector<size_t> row_begin(chunks + 1, 0);
+    parallel_for(chunks, chunks, [&](int, int begin, int end) {
+        for (int c = begin; c < end; c++) {
+            const char *first = text + chunk_begin[c];
+            const char *last = text + chunk_begin[c + 1];
+            size_t lines = std::count(first, last, '\n');
+            if (last > first && last[-1] != '\n') {
+                lines++;
+            }
+            row_begin[c + 1] = lines;
+        }
+    });
+    for (int c = 0; c < chunks; c++) {
+        row_begin[c + 1] += row_begin[c];
+    }
+
+    // Pass 2: parse every range straight into its slice of the columns.
+    std::vector<int32_t> xs(row_begin[chunks]), ys(row_begin[chunks]);
+    std::vector<int64_t> ids(row_begin[chunks]);
+    std::vector<size_t> rows(chunks, 0);
+    parallel_for(chunks, chunks, [&](int, int begin, int end) {
+        for (int c = begin; c < end; c++) {
+            const char *p = text + chunk_begin[c];
+            const char *last = text + chunk_begin[c + 1];
+            size_t row = row_begin[c];
+            while (p < last) {
+                const char *eol = static_cast<const char *>(std::memchr(p, '\n', last - p));
+                const char *next = eol ? eol + 1 : last;
+                const char *line_end = eol ? eol : last;
+                if (line_end > p && line_end[-1] == '\r') {
+                    line_end--;
+                }
+                if (line_end > p) {
+                    if (!parse_row(p, line_end, ids[row], xs[row], ys[row])) {
+                        // Only the very first line of the file may be a header.
+                        bool header = p == text && (*p < '0' || *p > '9') && *p != '-';
+                        if (!header) {
+                            throw std::runtime_error(path + ": malformed row at byte " + std::to_string(p - text));
+                        }
+                    } else {
+                        row++;
+                    }
+                }
+                p = next;
+            }
+            rows[c] = row - row_begin[c];
+        }
+    });
+
+    // Close the gaps left by headers and blank lines.
+    size_t records = 0;
+    for (int c = 0; c < chunks; c++) {
+        if (records != row_begin[c]) {
+            std::memmove(xs.data() + records, xs.data() + row_begin[c], rows[c] * sizeof(int32_t));
+            std::memmove(ys.data() + records, ys.data() + row_begin[c], rows[c] * sizeof(int32_t));
+            std::memmove(ids.data() + records, ids.data() + row_begin[c], rows[c] * sizeof(int64_t));
+        }
+        records += rows[c];
+    }
+    xs.resize(records);
+    ys.resize(records);
+    ids.resize(records);
+
+    // Contiguous partitions of near-equal size, in file order.
+    std::vector<uint64_t> provider_begin(providers + 1);
+    for (int p = 0; p <= providers; p++) {
+        provider_begin[p] = records * static_cast<uint64_t>(p) / providers;
+    }
+    return from_columns(std::move(xs), std::move(ys), std::move(provider_begin), std::move(ids));
+}
+
+/**
+ * @brief  Builds provider partitions that each sample a fraction of a dataset.
+ */
+Dataset Dataset::sample(const Dataset &source, int providers, double fraction, uint64_t seed, int workers) {
+    if (providers < 1) {
+        throw std::invalid_argument("a dataset needs at least one provider");
+    }
+    if (!(fraction > 0.0 && fraction <= 1.0)) {
+        throw std::invalid_argument("the sampling fraction must be in (0, 1]");
+    }
+    const size_t n = source.size();
+    const size_t k = static_cast<size_t>(std::llround(fraction * static_cast<double>(n)));
+
+    std::vector<uint64_t> provider_begin(providers + 1);
+    for (int p = 0; p <= providers; p++) {
+        provider_begin[p] = k * static_cast<uint64_t>(p);
+    }
+    const size_t total = k * static_cast<size_t>(providers);
+    std::vector<int32_t> xs(total), ys(total);
+    std::vector<int64_t> ids(source.id() ? total : 0);
+
+    parallel_for(providers, workers, [&](int, int begin, int end) {
+        for (int p = begin; p < end; p++) {
+            // Selection sampling (Knuth's Algorithm S): one pass, source order kept.
+            std::mt19937_64 gen(seed + static_cast<uint64_t>(p));
+            std::uniform_real_distribution<double> uniform(0.0, 1.0);
+            size_t out = provider_begin[p];
+            size_t needed = k;
+            for (size_t i = 0; i < n && needed > 0; i++) {
+                if (uniform(gen) * static_cast<double>(n - i) < static_cast<double>(needed)) {
+                    xs[out] = source.x()[i];
+                    ys[out] = source.y()[i];
+                    if (source.id()) {
+                        ids[out] = source.id()[i];
+                    }
+                    out++;
+                    needed--;
+                }
+            }
+        }
+    });
+    return from_columns(std::move(xs), std::move(ys), std::move(provider_begin), std::move(ids));
+}
+
+/**
+ * @brief  Writes the dataset in the binary columnar layout.
+ */
+void Dataset::save(const std::string &path) const {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        throw std::runtime_error("cannot create " + path);
+    }
+    DatasetFileHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, DATASET_MAGIC, sizeof(DATASET_MAGIC));
+    header.version = DATASET_VERSION;
+    header.flags = ids ? DATASET_HAS_IDS : 0;
+    header.records = record_count;
+    header.providers = provider_count;
+    DatasetSections sections(header.records, header.providers, ids != nullptr);
+
+    // Each section is written at its offset; the gaps are zero padding.
+    size_t written = 0;
+    auto put = [&](size_t at, const void *data, size_t bytes) {
+        static const char padding[8] = {0};
+        out.write(padding, static_cast<std::streamsize>(at - written));
+        out.write(static_cast<const char *>(data), static_cast<std::streamsize>(bytes));
+        written = at + bytes;
+    };
+    put(0, &header, sizeof(header));
+    put(sections.offsets, offsets, (provider_count + 1) * sizeof(uint64_t));
+    put(sections.x, xs, record_count * sizeof(int32_t));
+    put(sections.y, ys, record_count * sizeof(int32_t));
+    if (ids) {
+        put(sections.id, ids, record_count * sizeof(int64_t));
+    }
+    if (!out.flush()) {
+        throw std::runtime_error("cannot write " + path);
+    }
+}
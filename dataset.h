@@ -0,0 +1,176 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  dataset.h
+ *
+ *    Description:  Public interface for the data holder's dataset subsystem.
+ *                  A dataset is a set of quantized points (x, y), optionally with
+ *                  record ids, split into one contiguous partition per provider.
+ *                  Datasets are converted once from CSV into a binary columnar
+ *                  file, which a data holder maps into memory at startup instead
+ *                  of parsing it.
+ *
+ *        Version:  1.0
+ *
+ * =====================================================================================
+ */
+
+#ifndef DATASET_H
+#define DATASET_H
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+/**
+ * @note   File layout (host byte order, every section 8-byte aligned):
+ *         [header: DatasetFileHeader]
+ *         [provider offsets: (providers + 1) x uint64, the first record of each
+ *          provider followed by the record count]
+ *         [x column: records x int32]
+ *         [y column: records x int32]
+ *         [id column: records x int64, only if DATASET_HAS_IDS is set]
+ *         Provider p holds records [offset[p], offset[p + 1]).
+ */
+
+/// The magic bytes at the start of a dataset file.
+#define DATASET_MAGIC "PPRCDAT"
+
+/// The version of the file layout written by this module.
+#define DATASET_VERSION 1
+
+/// Header flag: the file carries an id column.
+#define DATASET_HAS_IDS 0x1
+
+/**
+ * @struct DatasetFileHeader
+ * @brief  The fixed-size header at the start of a dataset file.
+ */
+struct DatasetFileHeader {
+    char magic[8];      ///< DATASET_MAGIC, NUL-terminated.
+    uint32_t version;   ///< DATASET_VERSION.
+    uint32_t flags;     ///< A combination of DATASET_HAS_* flags.
+    uint64_t records;   ///< The number of records.
+    uint64_t providers; ///< The number of provider partitions.
+};
+
+/**
+ * @class Dataset
+ * @brief The columns of a data holder's records, either mapped from a file or owned.
+ *
+ * A mapped dataset is a read-only shared mapping of the file: loading it costs one
+ * mmap() whatever its size, nothing is parsed or copied, and data holders that map
+ * the same file share its pages. The accessors are the same for both kinds.
+ */
+class Dataset {
+public:
+    Dataset() = default;
+    ~Dataset();
+
+    Dataset(Dataset &&other) noexcept;
+    Dataset &operator=(Dataset &&other) noexcept;
+    Dataset(const Dataset &) = delete;
+    Dataset &operator=(const Dataset &) = delete;
+
+    /**
+     * @brief  Maps a dataset file into memory.
+     * @param  path  The file written by save().
+     * @throws std::runtime_error if the file cannot be mapped or is malformed.
+     */
+    static Dataset map(const std::string &path);
+
+    /**
+     * @brief  Wraps columns held in memory.
+     * @param  xs              The x-coordinate of every record.
+     * @param  ys              The y-coordinate of every record (same length as xs).
+     * @param  provider_begin  The first record of each provider, followed by the record
+     *                         count; non-decreasing, from 0.
+     * @param  ids             The id of every record, or empty for none.
+     * @throws std::invalid_argument if the columns or partitions are inconsistent.
+     */
+    static Dataset from_columns(std::vector<int32_t> xs, std::vector<int32_t> ys,
+                                std::vector<uint64_t> provider_begin, std::vector<int64_t> ids = {});
+
+    /**
+     * @brief  Reads a quantized CSV file of "id,x,y" rows (car_id,Column1,Column2).
+     * @note   The file is mapped and cut into one byte range per worker at line
+     *         boundaries; the workers parse their ranges with std::from_chars
+     *         straight into the final columns, which are allocated once. A first
+     *         line that does not start with a number is taken as a header. The
+     *         records are split into `providers` contiguous partitions of
+     *         near-equal size, in file order.
+     * @param  path       The CSV file.
+     * @param  providers  The number of partitions.
+     * @param  workers    The number of parsing threads.
+     * @throws std::runtime_error if the file cannot be read or a row is malformed.
+     */
+    static Dataset read_csv(const std::string &path, int providers = 1, int workers = 1);
+
+    /**
+     * @brief  Builds provider partitions that each sample a fraction of a dataset.
+     * @note   Provider p draws round(fraction * size) records without replacement,
+     *         with a generator seeded by seed + p, and keeps them in source order.
+     *         Providers sample independently, so their records overlap, as in the
+     *         Python simulation's Data_provider.load_true_false_dataset(). The
+     *         samples are not the ones pandas would draw for the same seed.
+     * @param  source     The records to sample from (its partitions are ignored).
+     * @param  providers  The number of providers.
+     * @param  fraction   The fraction of the records each provider holds, in (0, 1].
+     * @param  seed       The base seed.
+     * @param  workers    The number of threads; providers are sampled in parallel.
+     * @throws std::invalid_argument if the fraction or provider count is out of range.
+     */
+    static Dataset sample(const Dataset &source, int providers, double fraction, uint64_t seed, int workers = 1);
+
+    /**
+     * @brief  Writes the dataset in the binary columnar layout.
+     * @throws std::runtime_error if the file cannot be written.
+     */
+    void save(const std::string &path) const;
+
+    /// The number of records.
+    size_t size() const { return record_count; }
+
+    /// The number of provider partitions.
+    int providers() const { return static_cast<int>(provider_count); }
+
+    /// The first record of provider p; provider_begin(providers()) is size().
+    size_t provider_begin(int p) const { return static_cast<size_t>(offsets[p]); }
+
+    /// The x column.
+    const int32_t *x() const { return xs; }
+
+    /// The y column.
+    const int32_t *y() const { return ys; }
+
+    /// The id column, or nullptr if the dataset has no ids.
+    const int64_t *id() const { return ids; }
+
+    /// Whether the columns are mapped from a file.
+    bool mapped() const { return mapping != nullptr; }
+
+private:
+    /**
+     * @brief  Points the accessors at owned storage.
+     */
+    void attach_owned();
+
+    // Views of the columns, into either the mapping or the owned storage.
+    const uint64_t *offsets = nullptr;
+    const int32_t *xs = nullptr;
+    const int32_t *ys = nullptr;
+    const int64_t *ids = nullptr;
+    size_t record_count = 0;
+    size_t provider_count = 0;
+
+    void *mapping = nullptr; ///< The file mapping, if mapped.
+    size_t mapping_size = 0;
+
+    std::vector<uint64_t> owned_offsets;
+    std::vector<int32_t> owned_xs;
+    std::vector<int32_t> owned_ys;
+    std::vector<int64_t> owned_ids;
+};
+
+#endif // DATASET_H
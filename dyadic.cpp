@@ -0,0 +1,66 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  dyadic.cpp
+ *
+ *    Description:  Implementation of the dyadic range encoding.
+ *
+ *        Version:  1.0
+ *
+ * =====================================================================================
+ */
+
+#include "dyadic.h"
+#include <algorithm>
+
+/**
+ * @brief  Computes the canonical cover of a range by dyadic intervals.
+ * @param  lo    The first integer of the range.
+ * @param  hi    One past the last integer of the range.
+ * @param  bits  The number of domain bits D.
+ * @return The keys of the covering intervals.
+ */
+std::vector<int> dyadic_cover(int lo, int hi, int bits) {
+    std::vector<int> keys;
+    long long begin = std::max(lo, 0);
+    const long long end = std::min<long long>(hi, 1ll << bits);
+    while (begin < end) {
+        // The largest interval that starts at `begin` and does not pass `end`.
+        int level = 0;
+        while (level < bits && begin % (2ll << level) == 0 && begin + (2ll << level) <= end) {
+            level++;
+        }
+        keys.push_back(dyadic_key(level, static_cast<int>(begin >> level)));
+        begin += 1ll << level;
+    }
+    return keys;
+}
+
+/**
+ * @brief  Returns the largest number of intervals in the cover of a range of a given width.
+ * @param  width  The number of integers in the range.
+ */
+int dyadic_cover_bound(int width) {
+    int floor_log2 = 0;
+    while (width >> (floor_log2 + 1)) {
+        floor_log2++;
+    }
+    return std::max(1, 2 * floor_log2);
+}
+
+/**
+ * @brief  Computes the keys of the dyadic intervals that contain a value.
+ * @param  value  The coordinate.
+ * @param  bits   The number of domain bits D.
+ * @param  keys   Output array of at least bits + 1 keys.
+ * @return The number of keys written.
+ */
+int dyadic_prefixes(int value, int bits, int *keys) {
+    if (value < 0 || static_cast<long long>(value) >= (1ll << bits)) {
+        return 0;
+    }
+    for (int level = 0; level <= bits; level++) {
+        keys[level] = dyadic_key(level, value >> level);
+    }
+    return bits + 1;
+}
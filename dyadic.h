@@ -0,0 +1,68 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  dyadic.h
+ *
+ *    Description:  Public interface for the dyadic range encoding.
+ *                  With the point encoding a range filter holds every integer of
+ *                  the range, so it grows linearly with the range width. With the
+ *                  dyadic encoding over the domain [0, 2^D) the query user inserts
+ *                  the O(D) aligned power-of-two intervals that exactly cover the
+ *                  range, and a data holder probes the D + 1 intervals (prefixes)
+ *                  that contain a coordinate. A coordinate is in the range exactly
+ *                  when one of its prefixes is in the filter.
+ *
+ *        Version:  1.0
+ *
+ * =====================================================================================
+ */
+
+#ifndef DYADIC_H
+#define DYADIC_H
+
+#include <vector>
+
+/**
+ * @brief  The largest supported number of domain bits D.
+ * @note   Interval keys pack the level into 5 bits and the prefix above it, so
+ *         every key of a domain of up to 2^26 values is a non-negative int.
+ */
+#define DYADIC_MAX_BITS 26
+
+/**
+ * @brief  Returns the key of a dyadic interval.
+ * @param  level   The interval covers 2^level values.
+ * @param  prefix  The interval is [prefix * 2^level, (prefix + 1) * 2^level).
+ * @return The integer inserted into and probed in the Bloom filter.
+ */
+inline int dyadic_key(int level, int prefix) { return (prefix << 5) | level; }
+
+/**
+ * @brief  Computes the canonical cover of a range by dyadic intervals.
+ * @note   The intervals are disjoint, so a value lies in at most one of them, and
+ *         there are at most 2 * bits of them. The range is clipped to the domain.
+ * @param  lo    The first integer of the range.
+ * @param  hi    One past the last integer of the range.
+ * @param  bits  The number of domain bits D, in [1, DYADIC_MAX_BITS].
+ * @return The keys of the covering intervals.
+ */
+std::vector<int> dyadic_cover(int lo, int hi, int bits);
+
+/**
+ * @brief  Returns the largest number of intervals in the cover of a range of a given width.
+ * @note   This is max(1, 2 * floor(log2(width))), whatever the range's position, so
+ *         it sizes a filter that fits every range of that width.
+ * @param  width  The number of integers in the range (at least 1).
+ */
+int dyadic_cover_bound(int width);
+
+/**
+ * @brief  Computes the keys of the dyadic intervals that contain a value.
+ * @param  value  The coordinate.
+ * @param  bits   The number of domain bits D, in [1, DYADIC_MAX_BITS].
+ * @param  keys   Output array of at least bits + 1 keys, from level 0 up.
+ * @return The number of keys written: bits + 1, or 0 if the value is outside [0, 2^D).
+ */
+int dyadic_prefixes(int value, int bits, int *keys);
+
+#endif // DYADIC_H
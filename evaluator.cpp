@@ -0,0 +1,312 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  evaluator.cpp
+ *
+ *    Description:  Implementation of the data holder's range evaluation engine.
+ *
+ *        Version:  1.0
+ *
+ * =====================================================================================
+ */
+
+#include "evaluator.h"
+#include "dyadic.h"
+#include "parallel.h"
+#include <algorithm>
+
+/**
+ * @brief  Builds the distinct-value index of one coordinate column.
+ * @param  coords  The coordinate of every record.
+ * @param  count   The number of records.
+ */
+RangeEvaluator::CoordinateIndex::CoordinateIndex(const int32_t *coords, size_t count)
+    : values(coords, coords + count), slot(count) {
+    std::sort(values.begin(), values.end());
+    values.erase(std::unique(values.begin(), values.end()), values.end());
+
+    for (size_t i = 0; i < count; i++) {
+        slot[i] = static_cast<int>(std::lower_bound(values.begin(), values.end(), coords[i]) - values.begin());
+    }
+}
+
+/**
+ * @brief  Groups the records by identical point.
+ * @param  x_index  The index of the x-coordinates.
+ * @param  y_index  The index of the y-coordinates.
+ */
+RangeEvaluator::CellIndex::CellIndex(const CoordinateIndex &x_index, const CoordinateIndex &y_index) {
+    const size_t records = x_index.slot.size();
+    const uint64_t y_count = y_index.values.size();
+    std::vector<uint64_t> keys(records);
+    for (size_t i = 0; i < records; i++) {
+        keys[i] = static_cast<uint64_t>(x_index.slot[i]) * y_count + static_cast<uint64_t>(y_index.slot[i]);
+    }
+    std::vector<uint64_t> points(keys);
+    std::sort(points.begin(), points.end());
+    points.erase(std::unique(points.begin(), points.end()), points.end());
+    if (points.size() == records) {
+        return; // Every record is its own cell.
+    }
+
+    x_slot.resize(points.size());
+    y_slot.resize(points.size());
+    for (size_t c = 0; c < points.size(); c++) {
+        x_slot[c] = static_cast<int>(points[c] / y_count);
+        y_slot[c] = static_cast<int>(points[c] % y_count);
+    }
+    cell.resize(records);
+    for (size_t i = 0; i < records; i++) {
+        cell[i] = static_cast<int>(std::lower_bound(points.begin(), points.end(), keys[i]) - points.begin());
+    }
+}
+
+/**
+ * @brief  Constructs an evaluator over a data holder's records.
+ * @param  xs       The x-coordinate of every record.
+ * @param  ys       The y-coordinate of every record.
+ * @param  count    The number of records.
+ * @param  workers  The number of worker threads used by evaluate().
+ */
+RangeEvaluator::RangeEvaluator(const int32_t *xs, const int32_t *ys, size_t count, int workers)
+    : workers(std::max(1, workers)) {
+    // The pool threads are started now rather than by the first query.
+    reserve_workers(this->workers);
+    set_data(xs, ys, count);
+}
+
+/**
+ * @brief  Replaces the records and drops every cached probe table.
+ * @param  xs     The x-coordinate of every record.
+ * @param  ys     The y-coordinate of every record.
+ * @param  count  The number of records.
+ */
+void RangeEvaluator::set_data(const int32_t *xs, const int32_t *ys, size_t count) {
+    x_index = CoordinateIndex(xs, count);
+    y_index = CoordinateIndex(ys, count);
+    cells = CellIndex(x_index, y_index);
+
+    std::lock_guard<std::mutex> lock(probe_mutex);
+    probe_tables.clear();
+}
+
+/**
+ * @brief  Computes the keys of every value and their probe positions for one geometry and encoding.
+ * @param  values       The distinct coordinate values.
+ * @param  geometry     The geometry of the Bloom filter.
+ * @param  dyadic_bits  The domain bits of the dyadic encoding, or 0 for the point encoding.
+ * @return One row of geometry.hash_count positions per distinct key, and with the dyadic
+ *         encoding the rows of every value's prefixes.
+ */
+RangeEvaluator::KeyProbes RangeEvaluator::build_probes(const std::vector<int> &values, const BloomGeometry &geometry,
+                                                       int dyadic_bits) const {
+    const int k = geometry.hash_count;
+    KeyProbes table;
+    std::vector<int> keys = values;
+
+    if (dyadic_bits > 0) {
+        // The prefixes of all values, deduplicated: neighbouring values share their
+        // upper levels, so there are at most about twice as many keys as values.
+        const int levels = dyadic_bits + 1;
+        table.key_rows.assign(values.size() * levels, -1);
+        std::vector<int> prefixes(levels);
+        keys.clear();
+        for (int value : values) {
+            keys.insert(keys.end(), prefixes.begin(), prefixes.begin() + dyadic_prefixes(value, dyadic_bits, prefixes.data()));
+        }
+        std::sort(keys.begin(), keys.end());
+        keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+        parallel_for(static_cast<int>(values.size()), workers, [&](int, int begin, int end) {
+            std::vector<int> own(levels);
+            for (int v = begin; v < end; v++) {
+                const int count = dyadic_prefixes(values[v], dyadic_bits, own.data());
+                for (int l = 0; l < count; l++) {
+                    table.key_rows[static_cast<size_t>(v) * levels + l] =
+                        static_cast<int32_t>(std::lower_bound(keys.begin(), keys.end(), own[l]) - keys.begin());
+                }
+            }
+        });
+    }
+
+    table.probes.resize(keys.size() * k);
+    parallel_for(static_cast<int>(keys.size()), workers, [&](int, int begin, int end) {
+        int indices[BLOOM_MAX_HASH_COUNT];
+        for (int v = begin; v < end; v++) {
+            bloom_filter_probe(&geometry, keys[v], indices);
+            std::copy(indices, indices + k, table.probes.begin() + static_cast<size_t>(v) * k);
+        }
+    });
+    return table;
+}
+
+/**
+ * @brief  Returns the probe table of a geometry and encoding, building it on first use.
+ * @param  geometry     The geometry of the Bloom filters.
+ * @param  dyadic_bits  The domain bits of the dyadic encoding, or 0 for the point encoding.
+ * @return A shared table that stays valid even if it is later evicted.
+ */
+std::shared_ptr<const RangeEvaluator::ProbeTable> RangeEvaluator::probe_table(const BloomGeometry &geometry,
+                                                                              int dyadic_bits) const {
+    auto same = [&geometry, dyadic_bits](const std::shared_ptr<const ProbeTable> &table) {
+        const BloomGeometry &g = table->geometry;
+        return g.size == geometry.size && g.hash_count == geometry.hash_count &&
+               g.blocked == geometry.blocked && g.hash_scheme == geometry.hash_scheme &&
+               table->dyadic_bits == dyadic_bits;
+    };
+
+    // Holding the lock while building keeps concurrent queries of a new
+    // geometry from hashing the data twice.
+    std::lock_guard<std::mutex> lock(probe_mutex);
+    auto it = std::find_if(probe_tables.begin(), probe_tables.end(), same);
+    if (it != probe_tables.end()) {
+        return *it;
+    }
+
+    auto table = std::make_shared<ProbeTable>();
+    table->geometry = geometry;
+    table->dyadic_bits = dyadic_bits;
+    table->levels = dyadic_bits > 0 ? dyadic_bits + 1 : 1;
+    table->x = build_probes(x_index.values, geometry, dyadic_bits);
+    table->y = build_probes(y_index.values, geometry, dyadic_bits);
+
+    if (probe_tables.size() >= max_probe_tables) {
+        probe_tables.erase(probe_tables.begin());
+    }
+    probe_tables.push_back(table);
+    return table;
+}
+
+/**
+ * @brief  Computes the encrypted Bloom membership of every distinct value.
+ * @param  keys        The keys of the distinct values and their probe positions.
+ * @param  levels      The number of keys per value.
+ * @param  hash_count  The number of positions per key.
+ * @param  filter      The encrypted Bloom filter of this dimension.
+ * @param  scale       A residue folded into every product, or nullptr for none.
+ * @param  modulus     The public modulus N.
+ * @return One ciphertext per distinct value, up to a power of R.
+ */
+CiphertextVector RangeEvaluator::membership(const KeyProbes &keys, int levels, int hash_count,
+                                            const mp_limb_t *filter, const mp_limb_t *scale,
+                                            const Modulus &modulus) const {
+    const int count = static_cast<int>(keys.probes.size() / hash_count);
+    const size_t w = modulus.width();
+    CiphertextVector products(count, w);
+
+    parallel_for(count, workers, [&](int, int begin, int end) {
+        for (int v = begin; v < end; v++) {
+            // Homomorphic multiplication: E(a) * E(b) = E(a*b).
+            // If any bf_from_client[index] is E(0), the product becomes E(0).
+            // Each product is reduced in place in the arena.
+            const int32_t *row = keys.probes.data() + static_cast<size_t>(v) * hash_count;
+            if (scale) {
+                products.mont_mul(v, scale, filter + static_cast<size_t>(row[0]) * w, modulus);
+            } else {
+                products.set(v, filter + static_cast<size_t>(row[0]) * w);
+            }
+            for (int j = 1; j < hash_count; j++) {
+                products.mont_mul(v, products[v], filter + static_cast<size_t>(row[j]) * w, modulus);
+            }
+        }
+    });
+    if (levels == 1) {
+        return products;
+    }
+
+    // Homomorphic addition over the levels: at most one prefix lies in the disjoint
+    // cover, so the sum is E(1) exactly when the value is in range. All products
+    // carry the same power of R, and so does their sum.
+    const int values = static_cast<int>(keys.key_rows.size() / levels);
+    CiphertextVector sums(values, w);
+    parallel_for(values, workers, [&](int, int begin, int end) {
+        for (int v = begin; v < end; v++) {
+            const int32_t *rows = keys.key_rows.data() + static_cast<size_t>(v) * levels;
+            for (int l = 0; l < levels && rows[l] >= 0; l++) {
+                sums.add_mod(v, products[rows[l]], modulus);
+            }
+        }
+    });
+    return sums;
+}
+
+/**
+ * @brief  Computes the encrypted membership of every distinct x-coordinate in BFx.
+ */
+CiphertextVector RangeEvaluator::x_membership(const mp_limb_t *bfx, const BloomGeometry &geometry,
+                                              const Modulus &modulus, int dyadic_bits) const {
+    // k - 1 Montgomery products leave a factor R^-(k-1).
+    std::shared_ptr<const ProbeTable> table = probe_table(geometry, dyadic_bits);
+    return membership(table->x, table->levels, geometry.hash_count, bfx, nullptr, modulus);
+}
+
+/**
+ * @brief  Computes the encrypted membership of every distinct y-coordinate in BFy.
+ */
+CiphertextVector RangeEvaluator::y_membership(const mp_limb_t *bfy, const BloomGeometry &geometry,
+                                              const Modulus &modulus, int dyadic_bits) const {
+    // Starting from R^2k, k Montgomery products leave R^k, which cancels the
+    // x side's R^-(k-1) and the R^-1 of the final product in combine().
+    const unsigned k = static_cast<unsigned>(geometry.hash_count);
+    CiphertextVector scale(1, modulus.width());
+    scale.set_mod(0, modulus.radix_power(2 * k).get_mpz_t(), modulus);
+    std::shared_ptr<const ProbeTable> table = probe_table(geometry, dyadic_bits);
+    return membership(table->y, table->levels, geometry.hash_count, bfy, scale[0], modulus);
+}
+
+/**
+ * @brief  Combines the per-value memberships into one ciphertext per record.
+ * @param  x_products  One ciphertext per distinct x-coordinate.
+ * @param  y_products  One ciphertext per distinct y-coordinate.
+ * @param  modulus     The public modulus N.
+ * @return One ciphertext per record.
+ */
+CiphertextVector RangeEvaluator::combine(const CiphertextVector &x_products, const CiphertextVector &y_products,
+                                         const Modulus &modulus) const {
+    CiphertextVector sign_list(size(), modulus.width());
+
+    if (cells.cell.empty()) {
+        parallel_for(size(), workers, [&](int, int begin, int end) {
+            for (int i = begin; i < end; i++) {
+                // Final check: if both dimensions are in range, result is E(1), otherwise E(0).
+                // Each record has its own output slot, so workers never contend.
+                sign_list.mont_mul(i, x_products[x_index.slot[i]], y_products[y_index.slot[i]], modulus);
+            }
+        });
+        return sign_list;
+    }
+
+    // One final product per occupied cell, copied to every record at that point.
+    const int cell_count = static_cast<int>(cells.x_slot.size());
+    CiphertextVector cell_signs(cell_count, modulus.width());
+    parallel_for(cell_count, workers, [&](int, int begin, int end) {
+        for (int c = begin; c < end; c++) {
+            cell_signs.mont_mul(c, x_products[cells.x_slot[c]], y_products[cells.y_slot[c]], modulus);
+        }
+    });
+    parallel_for(size(), workers, [&](int, int begin, int end) {
+        for (int i = begin; i < end; i++) {
+            sign_list.set(i, cell_signs[cells.cell[i]]);
+        }
+    });
+
+    return sign_list;
+}
+
+/**
+ * @brief  Evaluates the encrypted range query against every record.
+ * @param  bfx          The encrypted Bloom filter of the x-range.
+ * @param  bfy          The encrypted Bloom filter of the y-range.
+ * @param  geometry     The geometry shared by the two Bloom filters.
+ * @param  modulus      The public modulus N.
+ * @param  dyadic_bits  The domain bits of the dyadic encoding, or 0 for the point encoding.
+ * @return One ciphertext per record.
+ */
+CiphertextVector RangeEvaluator::evaluate(const mp_limb_t *bfx, const mp_limb_t *bfy,
+                                          const BloomGeometry &geometry, const Modulus &modulus,
+                                          int dyadic_bits) const {
+    // Homomorphically check every distinct coordinate against its Bloom filter.
+    // This is equivalent to an AND operation in the plaintext domain.
+    CiphertextVector x_products = x_membership(bfx, geometry, modulus, dyadic_bits);
+    CiphertextVector y_products = y_membership(bfy, geometry, modulus, dyadic_bits);
+    return combine(x_products, y_products, modulus);
+}
@@ -0,0 +1,238 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  evaluator.h
+ *
+ *    Description:  Public interface for the data holder's range evaluation engine.
+ *                  The engine owns a data holder's coordinates and homomorphically
+ *                  tests each record against an encrypted query (two Bloom filters),
+ *                  spreading the work across a pool of worker threads.
+ *
+ *        Version:  1.0
+ *
+ * =====================================================================================
+ */
+
+#ifndef EVALUATOR_H
+#define EVALUATOR_H
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <cstdint>
+#include <gmpxx.h>
+#include "bloomfilter.h"
+#include "ciphertext.h"
+
+/**
+ * @class RangeEvaluator
+ * @brief Homomorphic point-in-range evaluation over a fixed set of records.
+ *
+ * For every record (x, y) the engine computes E(x in X) * E(y in Y), where the
+ * membership bits are the products of the encrypted Bloom filter entries at the
+ * record's probe positions. Records are partitioned into contiguous blocks, one
+ * per worker, so the output order never depends on thread scheduling.
+ *
+ * Membership only depends on the coordinate value, and quantized datasets repeat
+ * the same values across many records. The engine therefore indexes the distinct
+ * x and y values once, computes each membership product once per distinct value,
+ * and spends a single multiplication per record.
+ *
+ * Records at the same point (x, y) are indistinguishable to the evaluation, so
+ * the engine also groups them into cells: the final multiplication runs once per
+ * occupied cell and its result is copied to the cell's records. The grouping
+ * only uses the data, never the query, so it reveals nothing about the range.
+ * When every record has a point of its own the grouping is skipped.
+ *
+ * All products are Montgomery products (CiphertextVector::mont_mul), which avoid
+ * a long division per multiplication. Rather than converting the query into
+ * Montgomery form and the result back out, the engine tracks the power of R^-1
+ * each product picks up and cancels it with one precomputed factor of R per
+ * y-coordinate, so the ciphertexts in and out are plain residues mod N.
+ *
+ * The probe positions of a value depend only on the data and the Bloom filter
+ * geometry, never on the query's ciphertexts. The engine keeps a flat table of
+ * them for each geometry it has seen, built on first use and dropped only when
+ * the data changes, so a query is reduced to gathering and multiplying.
+ *
+ * With the dyadic range encoding (dyadic.h) the filters hold the intervals that
+ * cover each range, and a value's membership is the sum, over the D + 1 levels,
+ * of the products at the probes of its prefix on that level. The cover is
+ * disjoint, so the sum is E(1) for a value in range; only false positives can
+ * push it above 1, which, like a Bloom false positive, only counts the record.
+ * Values outside the domain [0, 2^D) have membership E(0). Neighbouring values
+ * share their upper prefixes, so each distinct prefix's product is computed once
+ * and a value costs D additions on top of the point encoding's products.
+ */
+class RangeEvaluator {
+public:
+    /**
+     * @brief  Constructs an evaluator over a data holder's records.
+     * @note   The columns are only read here; they need not outlive the evaluator.
+     * @param  xs       The x-coordinate of every record.
+     * @param  ys       The y-coordinate of every record.
+     * @param  count    The number of records.
+     * @param  workers  The number of worker threads used by evaluate().
+     */
+    RangeEvaluator(const int32_t *xs, const int32_t *ys, size_t count, int workers);
+
+    /**
+     * @brief  Replaces the records and drops every cached probe table.
+     * @note   Must not run concurrently with evaluate().
+     * @param  xs     The x-coordinate of every record.
+     * @param  ys     The y-coordinate of every record.
+     * @param  count  The number of records.
+     */
+    void set_data(const int32_t *xs, const int32_t *ys, size_t count);
+
+    /**
+     * @brief  Evaluates the encrypted range query against every record.
+     * @param  bfx       The encrypted Bloom filter of the x-range: geometry.size residues
+     *                   of modulus.width() limbs, stored contiguously.
+     * @param  bfy       The encrypted Bloom filter of the y-range, stored the same way.
+     * @param  geometry     The geometry shared by the two Bloom filters.
+     * @param  modulus      The public modulus N.
+     * @param  dyadic_bits  The domain bits D of the dyadic encoding, or 0 if the filters
+     *                      hold every integer of the ranges.
+     * @return One ciphertext per record, E(1) if the record is in range, E(0) otherwise.
+     */
+    CiphertextVector evaluate(const mp_limb_t *bfx, const mp_limb_t *bfy, const BloomGeometry &geometry,
+                              const Modulus &modulus, int dyadic_bits = 0) const;
+
+    /**
+     * @brief  Computes the encrypted membership of every distinct x-coordinate in BFx.
+     * @note   Together with y_membership() and combine() this is evaluate() split in
+     *         steps, so a data holder can start on BFx while BFy is still arriving.
+     *         The products are Montgomery products, so they carry a factor
+     *         R^-(k-1) mod N (k = hash_count) that y_membership() compensates;
+     *         they are only meaningful as input to combine().
+     * @return One ciphertext per distinct x-coordinate.
+     */
+    CiphertextVector x_membership(const mp_limb_t *bfx, const BloomGeometry &geometry, const Modulus &modulus,
+                                  int dyadic_bits = 0) const;
+
+    /**
+     * @brief  Computes the encrypted membership of every distinct y-coordinate in BFy.
+     * @note   The products carry a factor R^k mod N, which cancels the x side's and
+     *         combine()'s R^-1 factors.
+     * @return One ciphertext per distinct y-coordinate.
+     */
+    CiphertextVector y_membership(const mp_limb_t *bfy, const BloomGeometry &geometry, const Modulus &modulus,
+                                  int dyadic_bits = 0) const;
+
+    /**
+     * @brief  Combines the per-value memberships into one ciphertext per record.
+     * @param  x_products  The result of x_membership().
+     * @param  y_products  The result of y_membership().
+     * @param  modulus     The public modulus N.
+     * @return One ciphertext per record, E(1) if the record is in range, E(0) otherwise,
+     *         as plain residues mod N.
+     */
+    CiphertextVector combine(const CiphertextVector &x_products, const CiphertextVector &y_products,
+                             const Modulus &modulus) const;
+
+    /// The number of records held by the evaluator.
+    int size() const { return static_cast<int>(x_index.slot.size()); }
+
+    /// The number of worker threads used by evaluate().
+    int worker_count() const { return workers; }
+
+    /// The number of distinct x-coordinates (membership products per query on BFx).
+    int distinct_x() const { return static_cast<int>(x_index.values.size()); }
+
+    /// The number of distinct y-coordinates (membership products per query on BFy).
+    int distinct_y() const { return static_cast<int>(y_index.values.size()); }
+
+    /// The number of distinct points (final products per query).
+    int distinct_cells() const { return cells.cell.empty() ? size() : static_cast<int>(cells.x_slot.size()); }
+
+    /// The largest number of (geometry, encoding) pairs whose probe tables are kept.
+    static const size_t max_probe_tables = 16;
+
+private:
+    /**
+     * @struct CoordinateIndex
+     * @brief  Maps every record to the slot of its coordinate among the distinct values.
+     */
+    struct CoordinateIndex {
+        std::vector<int> values; ///< Sorted distinct coordinate values.
+        std::vector<int> slot;   ///< For each record, the position of its value in `values`.
+
+        CoordinateIndex() = default;
+        CoordinateIndex(const int32_t *coords, size_t count);
+    };
+
+    /**
+     * @struct CellIndex
+     * @brief  Groups the records by identical point (x, y).
+     * @note   Empty when every point is distinct, in which case records are their own cells.
+     */
+    struct CellIndex {
+        std::vector<int> x_slot; ///< For each cell, the slot of its x-coordinate.
+        std::vector<int> y_slot; ///< For each cell, the slot of its y-coordinate.
+        std::vector<int> cell;   ///< For each record, its cell.
+
+        CellIndex() = default;
+        CellIndex(const CoordinateIndex &x_index, const CoordinateIndex &y_index);
+    };
+
+    /**
+     * @struct KeyProbes
+     * @brief  The filter keys of one coordinate's distinct values and their probe positions.
+     * @note   With the point encoding the keys are the values themselves, row v of
+     *         `probes` belongs to value v and `key_rows` is empty.
+     */
+    struct KeyProbes {
+        std::vector<int32_t> probes;   ///< One row of hash_count positions per distinct key.
+        std::vector<int32_t> key_rows; ///< Dyadic only: per value, the probe row of each level's
+                                       ///< prefix, or -1 for values outside the domain.
+    };
+
+    /**
+     * @struct ProbeTable
+     * @brief  The probe positions of every distinct coordinate for one geometry and encoding.
+     */
+    struct ProbeTable {
+        BloomGeometry geometry;
+        int dyadic_bits; ///< 0 for the point encoding.
+        int levels;      ///< Keys per value: 1, or dyadic_bits + 1.
+        KeyProbes x;
+        KeyProbes y;
+    };
+
+    /**
+     * @brief  Returns the probe table of a geometry and encoding, building it on first use.
+     */
+    std::shared_ptr<const ProbeTable> probe_table(const BloomGeometry &geometry, int dyadic_bits) const;
+
+    /**
+     * @brief  Computes the keys of every value and their probe positions for one geometry and encoding.
+     */
+    KeyProbes build_probes(const std::vector<int> &values, const BloomGeometry &geometry, int dyadic_bits) const;
+
+    /**
+     * @brief  Computes the encrypted Bloom membership of every distinct value.
+     * @note   With several levels the membership is the sum of the levels' products.
+     * @param  keys        The keys of the distinct values and their probe positions.
+     * @param  levels      The number of keys per value.
+     * @param  hash_count  The number of positions per key.
+     * @param  filter      The encrypted Bloom filter of this dimension.
+     * @param  scale       A residue folded into every product, or nullptr for none.
+     * @param  modulus     The public modulus N.
+     * @return One ciphertext per distinct value, E(1) if it is in the filter, times
+     *         scale * R^-(hash_count - 1) (or R^-hash_count with a scale) mod N.
+     */
+    CiphertextVector membership(const KeyProbes &keys, int levels, int hash_count,
+                                const mp_limb_t *filter, const mp_limb_t *scale, const Modulus &modulus) const;
+
+    CoordinateIndex x_index;
+    CoordinateIndex y_index;
+    CellIndex cells;
+    int workers;
+
+    /// Probe tables of recently seen geometries, oldest first.
+    mutable std::vector<std::shared_ptr<const ProbeTable>> probe_tables;
+    mutable std::mutex probe_mutex;
+};
+
+#endif // EVALUATOR_H
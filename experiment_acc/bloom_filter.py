@@ -23,7 +23,8 @@ class BloomFilter:
         self.seed = seed
         self.size = self._get_size(capacity, error_rate)
         self.num_hashes = self._get_num_hashes(self.size, capacity)
-        self.bit_array = [0] * self.size
+        # Bits are packed eight to a byte instead of one Python int per bit.
+        self.bit_array = bytearray((self.size + 7) // 8)
 
     def _get_size(self, n: int, p: float) -> int:
         """
@@ -64,7 +65,7 @@ class BloomFilter:
             for i in range(self.num_hashes):
                 # Use a different seed for each hash function to simulate multiple hash functions
                 hash_value = mmh3.hash(str(item), seed=i + self.seed) % self.size
-                self.bit_array[hash_value] = 1
+                self.bit_array[hash_value >> 3] |= 1 << (hash_value & 7)
 
     def contains(self, item) -> int:
         """
@@ -79,6 +80,6 @@ class BloomFilter:
         """
         for i in range(self.num_hashes):
             hash_value = mmh3.hash(str(item), seed=i + self.seed) % self.size
-            if self.bit_array[hash_value] == 0:
+            if not (self.bit_array[hash_value >> 3] >> (hash_value & 7)) & 1:
                 return 0  # Definitely not in the set
         return 1 # Possibly in the set
\ No newline at end of file
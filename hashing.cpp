@@ -0,0 +1,92 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  hashing.cpp
+ *
+ *    Description:  Implementation of the shared integer hashing module.
+ *
+ *        Version:  1.0
+ *
+ * =====================================================================================
+ */
+
+#include "hashing.h"
+#include "MurmurHash3.h"
+#include <charconv> // Required for std::to_chars
+
+/**
+ * @brief  Returns whether a value names a known hash scheme.
+ */
+bool hash_scheme_valid(int scheme) {
+    return scheme == HASH_SCHEME_STRING_KEY || scheme == HASH_SCHEME_DOUBLE;
+}
+
+/**
+ * @brief  Hashes the decimal key "a|b" with MurmurHash3_x86_32.
+ * @param  a     The first integer of the key.
+ * @param  b     The second integer of the key.
+ * @param  seed  The MurmurHash3 seed.
+ * @return The 32-bit hash.
+ */
+uint32_t hash_string_key(int a, int b, uint32_t seed) {
+    // Two 11-character integers and a separator always fit.
+    char key[32];
+    char *end = std::to_chars(key, key + sizeof(key), a).ptr;
+    *end++ = '|';
+    end = std::to_chars(end, key + sizeof(key), b).ptr;
+
+    uint32_t hash_output;
+    MurmurHash3_x86_32(key, static_cast<int>(end - key), seed, &hash_output);
+    return hash_output;
+}
+
+/**
+ * @brief  Hashes the decimal key "a|b|c" with MurmurHash3_x86_32.
+ * @param  a     The first integer of the key.
+ * @param  b     The second integer of the key.
+ * @param  c     The third integer of the key.
+ * @param  seed  The MurmurHash3 seed.
+ * @return The 32-bit hash.
+ */
+uint32_t hash_string_key(int a, int b, int c, uint32_t seed) {
+    char key[48];
+    char *end = std::to_chars(key, key + sizeof(key), a).ptr;
+    *end++ = '|';
+    end = std::to_chars(end, key + sizeof(key), b).ptr;
+    *end++ = '|';
+    end = std::to_chars(end, key + sizeof(key), c).ptr;
+
+    uint32_t hash_output;
+    MurmurHash3_x86_32(key, static_cast<int>(end - key), seed, &hash_output);
+    return hash_output;
+}
+
+/**
+ * @brief  Hashes raw integers with one MurmurHash3_x64_128 call.
+ * @param  key    The integers to hash.
+ * @param  count  The number of integers in `key`.
+ * @param  seed   The MurmurHash3 seed.
+ * @param  out    Output: the two 64-bit halves (h1, h2) of the hash.
+ */
+void hash_int_key128(const int32_t *key, int count, uint32_t seed, uint64_t out[2]) {
+    MurmurHash3_x64_128(key, count * static_cast<int>(sizeof(int32_t)), seed, out);
+}
+
+/**
+ * @brief  Maps a 2D record to a bucket of a Linear Counting sketch.
+ * @param  scheme  The hash scheme of the query.
+ * @param  x       The x-coordinate of the record.
+ * @param  y       The y-coordinate of the record.
+ * @param  length  The number of buckets in the sketch.
+ * @param  seed    The seed of the sketch.
+ * @return The bucket index, in the range [0, length-1].
+ */
+int sketch_index(int scheme, int x, int y, int length, int seed) {
+    if (scheme == HASH_SCHEME_STRING_KEY) {
+        return static_cast<int>(hash_string_key(x, y, length, seed) % length);
+    }
+    const int32_t key[3] = { x, y, length };
+    uint64_t h[2];
+    hash_int_key128(key, 3, seed, h);
+    return static_cast<int>(h[0] % static_cast<uint64_t>(length));
+}
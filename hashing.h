@@ -0,0 +1,93 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  hashing.h
+ *
+ *    Description:  Public interface for the shared integer hashing module.
+ *                  This header declares the hash functions used to place
+ *                  elements in Bloom filters and records in Linear Counting
+ *                  sketches. None of them allocate memory.
+ *
+ *        Version:  1.0
+ *
+ * =====================================================================================
+ */
+
+#ifndef HASHING_H
+#define HASHING_H
+
+#include <cstdint>
+
+/**
+ * @enum   HashScheme
+ * @brief  Selects how integer keys are mapped to indices.
+ * @note   All parties of one query must use the same scheme: the query user
+ *         builds its filters with it, and every data holder probes the filters
+ *         and fills its sketch with it.
+ */
+typedef enum {
+    /// MurmurHash3_x86_32 over the decimal key "a|b" with one seed per index.
+    /// Reproduces the indices of the original string-keyed implementation.
+    HASH_SCHEME_STRING_KEY = 0,
+    /// One MurmurHash3_x64_128 call over the raw integers; the i-th index is
+    /// h1 + i * (h2 | 1) (Kirsch-Mitzenmacher double hashing).
+    HASH_SCHEME_DOUBLE = 1
+} HashScheme;
+
+/**
+ * @brief  Returns whether a value names a known hash scheme.
+ */
+bool hash_scheme_valid(int scheme);
+
+/**
+ * @brief  Hashes the decimal key "a|b" with MurmurHash3_x86_32.
+ * @note   Identical to hashing std::to_string(a) + "|" + std::to_string(b), but
+ *         the key is formatted into a stack buffer.
+ * @param  a     The first integer of the key.
+ * @param  b     The second integer of the key.
+ * @param  seed  The MurmurHash3 seed.
+ * @return The 32-bit hash.
+ */
+uint32_t hash_string_key(int a, int b, uint32_t seed);
+
+/**
+ * @brief  Hashes the decimal key "a|b|c" with MurmurHash3_x86_32.
+ * @param  a     The first integer of the key.
+ * @param  b     The second integer of the key.
+ * @param  c     The third integer of the key.
+ * @param  seed  The MurmurHash3 seed.
+ * @return The 32-bit hash.
+ */
+uint32_t hash_string_key(int a, int b, int c, uint32_t seed);
+
+/**
+ * @brief  Hashes raw integers with one MurmurHash3_x64_128 call.
+ * @param  key    The integers to hash.
+ * @param  count  The number of integers in `key`.
+ * @param  seed   The MurmurHash3 seed.
+ * @param  out    Output: the two 64-bit halves (h1, h2) of the hash.
+ */
+void hash_int_key128(const int32_t *key, int count, uint32_t seed, uint64_t out[2]);
+
+/**
+ * @brief  Returns the i-th Kirsch-Mitzenmacher hash derived from (h1, h2).
+ * @note   The step h2 is forced odd so that it is coprime to any power-of-two
+ *         size, such as a BLOOM_BLOCK_BITS block, and the probes of a key never
+ *         fall into a short cycle.
+ */
+inline uint64_t double_hash(const uint64_t h[2], int i) {
+    return h[0] + static_cast<uint64_t>(i) * (h[1] | 1);
+}
+
+/**
+ * @brief  Maps a 2D record to a bucket of a Linear Counting sketch.
+ * @param  scheme  The hash scheme of the query.
+ * @param  x       The x-coordinate of the record.
+ * @param  y       The y-coordinate of the record.
+ * @param  length  The number of buckets in the sketch.
+ * @param  seed    The seed of the sketch.
+ * @return The bucket index, in the range [0, length-1].
+ */
+int sketch_index(int scheme, int x, int y, int length, int seed);
+
+#endif // HASHING_H
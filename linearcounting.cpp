@@ -42,14 +42,10 @@ LinearCounting::~LinearCounting() {
  * @param  y     The y-coordinate.
  */
 void LinearCounting::insert(int seed, int x, int y) {
-    uint32_t hash_result;
-
-    // Create a unique string key from the (x, y) pair to treat it as a single item.
+    // Hash the (x, y) pair as the single key "x|y" to treat it as a single item.
     // The "|" separator prevents collisions, e.g., (12, 3) vs (1, 23).
-    std::string key = std::to_string(x) + "|" + std::to_string(y);
-
-    // Compute the hash using the MurmurHash3 algorithm.
-    MurmurHash3_x86_32(key.c_str(), key.size(), seed, &hash_result);
+    // The key is formatted on the stack, so no string is allocated per insert.
+    uint32_t hash_result = hash_string_key(x, y, seed);
 
     // Map the 32-bit hash value to a valid index in the bit array.
     int bit_index = hash_result % size;
@@ -22,7 +22,7 @@
 // #include <cmath>
 #include <bits/stdc++.h>
 
-#include "MurmurHash3.h"
+#include "hashing.h"
 
 /**
  * @class LinearCounting
@@ -0,0 +1,326 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  parallel.cpp
+ *
+ *    Description:  Implementation of the worker pool helpers. Every call runs on
+ *                  one persistent, process-wide pool of threads.
+ *
+ *        Version:  1.0
+ *
+ * =====================================================================================
+ */
+
+#include "parallel.h"
+#include <thread>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <memory>
+
+/**
+ * @brief  Returns the default number of worker threads for this machine.
+ * @return The hardware concurrency reported by the runtime, or 1 if unknown.
+ */
+int default_worker_count() {
+    unsigned int n = std::thread::hardware_concurrency();
+    return n == 0 ? 1 : static_cast<int>(n);
+}
+
+namespace {
+
+/**
+ * @class WorkerPool
+ * @brief The process-wide threads that run the blocks of parallel_for and parallel_pipeline.
+ *
+ * The threads are started on first use (or by reserve_workers()) and kept until the
+ * process exits, so no thread is created or joined on a query's path. The pool only
+ * grows: it holds as many threads as the largest call has asked for, less the caller.
+ */
+class WorkerPool {
+public:
+    static WorkerPool &instance() {
+        static WorkerPool pool;
+        return pool;
+    }
+
+    /**
+     * @brief  Makes sure at least `count` threads are running.
+     */
+    void reserve(int count) {
+        std::lock_guard<std::mutex> lock(mutex);
+        while (static_cast<int>(threads.size()) < count) {
+            threads.emplace_back([this]() { run(); });
+        }
+    }
+
+    /**
+     * @brief  Queues `copies` runs of a task; the task must not throw.
+     */
+    void submit(const std::function<void()> &task, int copies) {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (int i = 0; i < copies; ++i) {
+            tasks.push_back(task);
+        }
+        if (copies == 1) {
+            ready.notify_one();
+        } else {
+            ready.notify_all();
+        }
+    }
+
+    ~WorkerPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        ready.notify_all();
+        for (std::thread &t : threads) {
+            t.join();
+        }
+    }
+
+private:
+    WorkerPool() = default;
+
+    void run() {
+        for (;;) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                ready.wait(lock, [this]() { return stopping || !tasks.empty(); });
+                if (tasks.empty()) {
+                    return;
+                }
+                task = std::move(tasks.front());
+                tasks.pop_front();
+            }
+            task();
+        }
+    }
+
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::deque<std::function<void()>> tasks;
+    std::vector<std::thread> threads;
+    bool stopping = false;
+};
+
+} // namespace
+
+/**
+ * @brief  Starts the pool threads needed by calls with `workers` workers.
+ * @param  workers  The number of workers, counting the calling thread.
+ */
+void reserve_workers(int workers) {
+    WorkerPool::instance().reserve(workers - 1);
+}
+
+/**
+ * @brief  Runs a loop body over [0, count) split across a pool of workers.
+ * @param  count    The number of loop iterations.
+ * @param  workers  The requested number of workers (clamped to [1, count]).
+ * @param  body     Called once per block as body(worker, begin, end).
+ */
+void parallel_for(int count, int workers, const std::function<void(int worker, int begin, int end)> &body) {
+    if (count <= 0) {
+        return;
+    }
+    workers = std::max(1, std::min(workers, count));
+
+    // Block w covers [w * count / workers, (w + 1) * count / workers).
+    auto block_begin = [count, workers](int w) {
+        return static_cast<int>(static_cast<long long>(w) * count / workers);
+    };
+
+    if (workers == 1) {
+        body(0, 0, count);
+        return;
+    }
+
+    // The blocks are claimed from a shared counter by the pool threads and by the
+    // calling thread alike, so the call completes even if every pool thread is busy.
+    // A pool thread that starts after all blocks are claimed returns without touching
+    // `body`, which is why the state it reads is shared rather than on this stack.
+    struct Job {
+        std::atomic<int> next{0};
+        int done = 0;
+        std::mutex mutex;
+        std::condition_variable finished;
+        std::vector<std::exception_ptr> errors;
+    };
+    auto job = std::make_shared<Job>();
+    job->errors.resize(workers);
+    const std::function<void(int, int, int)> *work = &body;
+    auto run_blocks = [job, work, workers, block_begin]() {
+        for (;;) {
+            const int w = job->next.fetch_add(1);
+            if (w >= workers) {
+                return;
+            }
+            try {
+                (*work)(w, block_begin(w), block_begin(w + 1));
+            } catch (...) {
+                job->errors[w] = std::current_exception();
+            }
+            std::lock_guard<std::mutex> lock(job->mutex);
+            if (++job->done == workers) {
+                job->finished.notify_all();
+            }
+        }
+    };
+
+    WorkerPool &pool = WorkerPool::instance();
+    pool.reserve(workers - 1);
+    pool.submit(run_blocks, workers - 1);
+    run_blocks();
+    {
+        std::unique_lock<std::mutex> lock(job->mutex);
+        job->finished.wait(lock, [&]() { return job->done == workers; });
+    }
+    for (const std::exception_ptr &e : job->errors) {
+        if (e) {
+            std::rethrow_exception(e);
+        }
+    }
+}
+
+/**
+ * @brief  Produces blocks [0, count) on a pool of workers and consumes them in order.
+ * @param  count    The number of blocks.
+ * @param  workers  The requested number of producing workers (clamped to [1, count]).
+ * @param  window   The maximum number of blocks produced ahead of consumption.
+ * @param  produce  Called once per block as produce(worker, block).
+ * @param  consume  Called once per block as consume(block), in order, on the calling thread.
+ */
+void parallel_pipeline(int count, int workers, int window,
+                       const std::function<void(int worker, int block)> &produce,
+                       const std::function<void(int block)> &consume) {
+    if (count <= 0) {
+        return;
+    }
+    workers = std::max(1, std::min(workers, count));
+    window = std::max(1, window);
+
+    if (workers == 1) {
+        for (int block = 0; block < count; ++block) {
+            produce(0, block);
+            consume(block);
+        }
+        return;
+    }
+
+    // The state is shared with the pool threads, which may only start after this
+    // call has returned; they then find nothing to claim and leave.
+    struct Pipeline {
+        std::mutex mutex;
+        std::condition_variable changed;
+        int claimed = 0;          // The next block a worker may claim.
+        int consumed = 0;         // The number of blocks consumed so far.
+        int producing = 0;        // The number of produce() calls in progress.
+        int next_worker = 1;      // The index of the next pool thread to join.
+        std::vector<int> produced; // The block last produced into each slot.
+        std::exception_ptr error;
+
+        void fail(std::exception_ptr e) {
+            if (!error) {
+                error = e;
+            }
+            changed.notify_all();
+        }
+    };
+    auto state = std::make_shared<Pipeline>();
+    state->produced.assign(window, -1);
+    const std::function<void(int, int)> *make = &produce;
+
+    auto producer = [state, make, count, window]() {
+        std::unique_lock<std::mutex> lock(state->mutex);
+        const int w = state->next_worker++;
+        for (;;) {
+            // A block may reuse its slot once the block `window` before it is consumed.
+            state->changed.wait(lock, [&]() {
+                return state->error || state->claimed >= count || state->claimed < state->consumed + window;
+            });
+            if (state->error || state->claimed >= count) {
+                return;
+            }
+            const int block = state->claimed++;
+            state->producing++;
+            lock.unlock();
+            std::exception_ptr error;
+            try {
+                (*make)(w, block);
+            } catch (...) {
+                error = std::current_exception();
+            }
+            lock.lock();
+            state->producing--;
+            if (error) {
+                state->fail(error);
+            } else {
+                state->produced[block % window] = block;
+            }
+            state->changed.notify_all();
+        }
+    };
+
+    WorkerPool &pool = WorkerPool::instance();
+    pool.reserve(workers - 1);
+    pool.submit(producer, workers - 1);
+
+    std::unique_lock<std::mutex> lock(state->mutex);
+    for (int block = 0; block < count && !state->error; ++block) {
+        // Wait for the block, producing it on this thread if no worker has claimed it yet.
+        state->changed.wait(lock, [&]() {
+            return state->error || state->produced[block % window] == block || state->claimed <= block;
+        });
+        if (state->error) {
+            break;
+        }
+        if (state->produced[block % window] != block) {
+            const int own = state->claimed++;
+            state->producing++;
+            lock.unlock();
+            std::exception_ptr error;
+            try {
+                produce(0, own);
+            } catch (...) {
+                error = std::current_exception();
+            }
+            lock.lock();
+            state->producing--;
+            if (error) {
+                state->fail(error);
+            } else {
+                state->produced[own % window] = own;
+            }
+            state->changed.notify_all();
+            --block; // Check the block again.
+            continue;
+        }
+        lock.unlock();
+        std::exception_ptr error;
+        try {
+            consume(block);
+        } catch (...) {
+            error = std::current_exception();
+        }
+        lock.lock();
+        if (error) {
+            state->fail(error);
+            break;
+        }
+        state->consumed = block + 1;
+        state->changed.notify_all();
+    }
+
+    // No produce() may still be running once this call returns.
+    state->changed.wait(lock, [&]() { return state->producing == 0; });
+    if (state->error) {
+        std::rethrow_exception(state->error);
+    }
+}
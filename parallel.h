@@ -0,0 +1,75 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  parallel.h
+ *
+ *    Description:  Public interface for the worker pool helpers.
+ *                  This header declares a static-partition parallel loop used by
+ *                  the PPRC roles to spread big-integer work across CPU cores,
+ *                  and an ordered pipeline that overlaps such work with I/O.
+ *
+ *        Version:  1.0
+ *
+ * =====================================================================================
+ */
+
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <functional>
+
+/**
+ * @brief  Returns the default number of worker threads for this machine.
+ * @return The hardware concurrency reported by the runtime, or 1 if unknown.
+ */
+int default_worker_count();
+
+/**
+ * @brief  Starts the pool threads that calls with `workers` workers need.
+ * @note   parallel_for() and parallel_pipeline() run on one persistent pool of
+ *         threads shared by the whole process. It grows on demand, so calling
+ *         this is optional; it keeps thread creation out of the first call.
+ * @param  workers  The number of workers, counting the calling thread.
+ */
+void reserve_workers(int workers);
+
+/**
+ * @brief  Runs a loop body over [0, count) split across a pool of workers.
+ * @note   The range is cut into `workers` contiguous blocks of near-equal size,
+ *         so the blocks depend only on (count, workers); the `worker` passed
+ *         with a block is its index, unique within the call. The blocks run on
+ *         the persistent pool and on the calling thread, which keeps claiming
+ *         blocks until none is left, so a call completes even when every pool
+ *         thread is busy. If any block throws, the first exception is rethrown
+ *         after all blocks have finished.
+ * @param  count    The number of loop iterations.
+ * @param  workers  The requested number of workers (clamped to [1, count]).
+ * @param  body     Called once per block as body(worker, begin, end).
+ */
+void parallel_for(int count, int workers, const std::function<void(int worker, int begin, int end)> &body);
+
+/**
+ * @brief  Produces blocks [0, count) on a pool of workers and consumes them in order.
+ * @note   Workers claim blocks in increasing order and run produce() on them
+ *         concurrently; the calling thread runs consume() on each block as soon
+ *         as it and all earlier blocks are produced, so consumption (e.g.
+ *         writing to a socket) overlaps with the production of later blocks.
+ *         No block is produced until the block `window` places before it has
+ *         been consumed, so the caller can keep `window` result slots and
+ *         reuse slot (block % window). With one worker the blocks are produced
+ *         and consumed alternately on the calling thread. The producers are
+ *         threads of the persistent pool; when the next block to consume has not
+ *         been claimed by any of them, the calling thread produces it itself. If
+ *         any call throws, no further blocks are started and the first exception
+ *         is rethrown once no produce() call is running.
+ * @param  count    The number of blocks.
+ * @param  workers  The requested number of producing workers (clamped to [1, count]).
+ * @param  window   The maximum number of blocks produced ahead of consumption (at least 1).
+ * @param  produce  Called once per block as produce(worker, block), on any worker.
+ * @param  consume  Called once per block as consume(block), in order, on the calling thread.
+ */
+void parallel_pipeline(int count, int workers, int window,
+                       const std::function<void(int worker, int block)> &produce,
+                       const std::function<void(int block)> &consume);
+
+#endif // PARALLEL_H
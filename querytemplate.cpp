@@ -0,0 +1,68 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  querytemplate.cpp
+ *
+ *    Description:  Implementation of the query user's range template cache.
+ *
+ *        Version:  1.0
+ *
+ * =====================================================================================
+ */
+
+#include "querytemplate.h"
+#include "dyadic.h"
+#include <algorithm>
+
+/**
+ * @brief  Constructs an empty cache.
+ * @param  capacity  The number of templates kept.
+ */
+QueryTemplateCache::QueryTemplateCache(size_t capacity) : capacity(std::max<size_t>(1, capacity)) {
+}
+
+/**
+ * @brief  Returns the template of [lo, hi) for a geometry, building it on a miss.
+ * @param  geometry     The filter geometry.
+ * @param  dyadic_bits  0 for the point encoding, or the domain bits of the dyadic encoding.
+ * @param  lo           The first integer of the range.
+ * @param  hi           One past the last integer of the range.
+ */
+std::shared_ptr<const RangeTemplate> QueryTemplateCache::get(const BloomGeometry &geometry, int dyadic_bits,
+                                                             int lo, int hi) {
+    Key key(geometry.size, geometry.hash_count, geometry.blocked, geometry.hash_scheme, dyadic_bits, lo, hi);
+    auto found = index.find(key);
+    if (found != index.end()) {
+        hit_count++;
+        entries.splice(entries.begin(), entries, found->second);
+        return found->second->second;
+    }
+    miss_count++;
+
+    auto built = std::make_shared<RangeTemplate>();
+    built->bits.assign(geometry.size, 0);
+    std::vector<int> elements;
+    if (dyadic_bits > 0) {
+        elements = dyadic_cover(lo, hi, dyadic_bits);
+    } else {
+        for (int value = lo; value < hi; value++) {
+            elements.push_back(value);
+        }
+    }
+    int probes[BLOOM_MAX_HASH_COUNT];
+    for (int element : elements) {
+        bloom_filter_probe(&geometry, element, probes);
+        for (int i = 0; i < geometry.hash_count; i++) {
+            built->bits[probes[i]] = 1;
+        }
+    }
+    built->ones = static_cast<size_t>(std::count(built->bits.begin(), built->bits.end(), 1));
+
+    entries.emplace_front(key, built);
+    index[key] = entries.begin();
+    if (entries.size() > capacity) {
+        index.erase(entries.back().first);
+        entries.pop_back();
+    }
+    return built;
+}
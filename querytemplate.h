@@ -0,0 +1,82 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  querytemplate.h
+ *
+ *    Description:  Public interface for the query user's range template cache.
+ *                  A template is the bit pattern of the Bloom filter that encodes
+ *                  one range [lo, hi), point by point or by its dyadic cover; users
+ *                  issue the same ranges over and over, so recently used templates
+ *                  are kept instead of rebuilt.
+ *
+ *        Version:  1.0
+ *
+ * =====================================================================================
+ */
+
+#ifndef QUERYTEMPLATE_H
+#define QUERYTEMPLATE_H
+
+#include <list>
+#include <map>
+#include <memory>
+#include <tuple>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include "bloomfilter.h"
+
+/**
+ * @struct RangeTemplate
+ * @brief  The bits of a Bloom filter that encodes a range.
+ */
+struct RangeTemplate {
+    std::vector<uint8_t> bits; ///< One entry (0 or 1) per filter bit.
+    size_t ones = 0;           ///< The number of set bits.
+};
+
+/**
+ * @class QueryTemplateCache
+ * @brief A least-recently-used cache of range templates.
+ *
+ * Templates are built from the filter geometry alone with bloom_filter_probe(),
+ * so they match what the data holders reproduce. They are plaintext and never
+ * leave the query user; only their fresh encryptions are sent.
+ */
+class QueryTemplateCache {
+public:
+    /**
+     * @brief  Constructs an empty cache.
+     * @param  capacity  The number of templates kept (at least 1).
+     */
+    explicit QueryTemplateCache(size_t capacity = 64);
+
+    /**
+     * @brief  Returns the template of [lo, hi) for a geometry, building it on a miss.
+     * @note   The returned template stays valid after it is evicted.
+     * @param  geometry     The filter geometry.
+     * @param  dyadic_bits  0 to insert every integer of the range, or the domain bits D
+     *                      to insert its dyadic cover (dyadic.h).
+     * @param  lo           The first integer of the range.
+     * @param  hi           One past the last integer of the range.
+     */
+    std::shared_ptr<const RangeTemplate> get(const BloomGeometry &geometry, int dyadic_bits, int lo, int hi);
+
+    /// The number of lookups answered from the cache.
+    size_t hits() const { return hit_count; }
+
+    /// The number of lookups that built a template.
+    size_t misses() const { return miss_count; }
+
+private:
+    typedef std::tuple<int, int, int, int, int, int, int> Key;
+    typedef std::list<std::pair<Key, std::shared_ptr<const RangeTemplate>>> Entries;
+
+    size_t capacity;
+    Entries entries;                            ///< Most recently used first.
+    std::map<Key, Entries::iterator> index;
+    size_t hit_count = 0;
+    size_t miss_count = 0;
+};
+
+#endif // QUERYTEMPLATE_H
@@ -5,10 +5,12 @@
  *
  *    Description:  Server (the data holder) application for PPRC. 
  *                  This server simulates multiple data holders.
- *                  It receives an encrypted query (as Bloom filters) from a
- *                  central server, homomorphically processes the query against
+ *                  It receives encrypted queries (as Bloom filters) from
+ *                  central servers, homomorphically processes each query against
  *                  its local dataset, generates an encrypted Linear Counting
- *                  sketch as a result, and sends it back.
+ *                  sketch as a result, and sends it back. The dataset and the
+ *                  caches derived from it are built once and shared by all
+ *                  connections and queries.
  *
  *        Version:  1.0
  *
@@ -21,205 +23,598 @@
 #include <string>
 #include <chrono>
 #include <random>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <stdexcept>
+#include <future>
+#include <functional>
+#include <condition_variable>
+#include <deque>
+#include <set>
+#include <algorithm>
+#include <sys/socket.h>
 #include <gmpxx.h>
-#include "MurmurHash3.h"
+#include "bloomfilter.h"
+#include "hashing.h"
+#include "evaluator.h"
+#include "dyadic.h"
+#include "parallel.h"
+#include "wire.h"
+#include "ciphertext.h"
+#include "dataset.h"
 
 using boost::asio::ip::tcp;
 
 
 /**
- * @brief  Serializes and sends a vector of mpz_class numbers over a TCP socket.
- * @note   This function implements a custom binary protocol:
- *         1. A 4-byte header with the total buffer length is sent first.
- *         2. The main buffer follows, containing a sequence of numbers.
- *         3. Each number is encoded as [4-byte length][binary data].
- * @param  socket   The active Boost.Asio TCP socket.
- * @param  numbers  A constant reference to the vector of mpz_class to send.
+ * @brief  Generates a random integer within a specified range.
+ * @note   Each thread has its own engine, so concurrent queries never share state.
  */
-void send_multiple_mpz_class(tcp::socket &socket, const std::vector<mpz_class> &numbers) {
-    std::vector<uint8_t> buffer;
-    buffer.reserve(numbers.size() * 520);
-
-    for (const auto &num : numbers) {
-        size_t count = 0;
-        void *bin = mpz_export(nullptr, &count, 1, 1, 1, 0, num.get_mpz_t());
-
-        uint32_t len = static_cast<uint32_t>(count);
-        uint8_t *len_ptr = reinterpret_cast<uint8_t *>(&len);
-        buffer.insert(buffer.end(), len_ptr, len_ptr + sizeof(len));
-        buffer.insert(buffer.end(), reinterpret_cast<uint8_t *>(bin), reinterpret_cast<uint8_t *>(bin) + len);
-
-        free(bin);
-    }
-
-    uint32_t total_length = static_cast<uint32_t>(buffer.size());
-    boost::asio::write(socket, boost::asio::buffer(&total_length, sizeof(total_length)));
-    boost::asio::write(socket, boost::asio::buffer(buffer));
+int generateRandomNumber(int lowerBound, int upperBound) {
+    thread_local std::mt19937 gen(std::chrono::steady_clock::now().time_since_epoch().count() +
+                                  std::hash<std::thread::id>()(std::this_thread::get_id()));
+    std::uniform_int_distribution<> RandomNumber(lowerBound, upperBound);
+    return RandomNumber(gen);
 }
 
 
 /**
- * @brief  Receives and deserializes a vector of mpz_class numbers from a TCP socket.
- * @note   This function reads data according to the custom binary protocol defined
- *         in send_multiple_mpz_class.
- * @param  socket  The active Boost.Asio TCP socket.
- * @return A vector containing the received mpz_class numbers.
+ * @class DataHolder
+ * @brief The state a data holder loads once and keeps warm across queries.
+ *
+ * Besides the records themselves this holds the range evaluator (with its
+ * distinct-coordinate index and Bloom probe tables) and, per hash scheme, every
+ * provider's records grouped by sketch bucket. All of it is read-only once
+ * built, so any number of connections may answer queries concurrently.
  */
-std::vector<mpz_class> receive_multiple_mpz_class(tcp::socket &socket) {
-    uint32_t total_length;
-    boost::asio::read(socket, boost::asio::buffer(&total_length, sizeof(total_length)));
+class DataHolder {
+public:
+    /**
+     * @brief  Constructs a data holder over the records of its simulated providers.
+     * @param  data       The records, one partition per simulated provider. A mapped
+     *                    dataset stays mapped for the lifetime of the data holder.
+     * @param  lc_length  The size of each provider's Linear Counting sketch.
+     * @param  workers    The number of threads used per query.
+     */
+    DataHolder(Dataset data, int lc_length, int workers)
+        : data(std::move(data)), server_number(this->data.providers()), lc_length(lc_length),
+          evaluator(this->data.x(), this->data.y(), this->data.size(), workers) {
+    }
 
-    std::vector<uint8_t> buffer(total_length);
-    boost::asio::read(socket, boost::asio::buffer(buffer));
+    /**
+     * @brief  Answers a batch of encrypted range queries while it is still being received.
+     * @note   The batch is [hash_count][blocked][hash_scheme][D][m][N][Q][E(0)][E(0)]
+     *         [BFx 1][BFy 1]...[BFx Q][BFy Q] (see QueryField). The queries are answered
+     *         one after the other in a single pass: the probe tables, the sketch groups
+     *         and the blinding tables are shared by the whole batch. Each query's
+     *         ciphertexts are read straight into one arena and used in place. BFx is
+     *         evaluated as soon as it is complete, while BFy is still being read, and
+     *         every provider's sketch is written as soon as it is built.
+     * @param  reader  The reader positioned at the start of the query message.
+     * @param  writer  The writer that receives the reply [P][S][Q] and then, query by
+     *                 query, the sketches of providers 0, ..., P-1 (see ReplyField).
+     * @throws std::runtime_error if the query is malformed.
+     */
+    void answer(MpzStreamReader &reader, MpzStreamWriter &writer) const {
+        // The plaintext parameters lead the query, so they arrive first.
+        std::vector<mpz_class> query_header;
+        if (!reader.read_until(query_header, QUERY_E0_1) || query_header.size() != QUERY_E0_1) {
+            throw std::runtime_error("malformed query parameters");
+        }
+        BloomGeometry geometry;
+        geometry.size = static_cast<int>(query_header[QUERY_FILTER_SIZE].get_si());
+        geometry.hash_count = static_cast<int>(query_header[QUERY_HASH_COUNT].get_si());
+        geometry.blocked = static_cast<int>(query_header[QUERY_BLOCKED].get_si());
+        geometry.hash_scheme = static_cast<int>(query_header[QUERY_HASH_SCHEME].get_si());
+        const long dyadic_bits = query_header[QUERY_DYADIC_BITS].get_si();
+        const long batch_size = query_header[QUERY_BATCH_SIZE].get_si();
+        if (geometry.size < 1 || geometry.size > max_filter_size) {
+            throw std::runtime_error("unsupported Bloom filter size " + query_header[QUERY_FILTER_SIZE].get_str());
+        }
+        if (geometry.hash_count < 1 || geometry.hash_count > BLOOM_MAX_HASH_COUNT) {
+            throw std::runtime_error("unsupported Bloom filter hash count " + std::to_string(geometry.hash_count));
+        }
+        if (query_header[QUERY_BLOCKED] != 0 && query_header[QUERY_BLOCKED] != 1) {
+            throw std::runtime_error("invalid Bloom filter layout " + query_header[QUERY_BLOCKED].get_str());
+        }
+        if (geometry.blocked && geometry.size % BLOOM_BLOCK_BITS != 0) {
+            throw std::runtime_error("blocked Bloom filter size " + query_header[QUERY_FILTER_SIZE].get_str() +
+                                     " is not a multiple of " + std::to_string(BLOOM_BLOCK_BITS));
+        }
+        if (!hash_scheme_valid(geometry.hash_scheme)) {
+            throw std::runtime_error("unknown hash scheme " + std::to_string(geometry.hash_scheme));
+        }
+        if (dyadic_bits < 0 || dyadic_bits > DYADIC_MAX_BITS) {
+            throw std::runtime_error("unsupported dyadic domain bits " + query_header[QUERY_DYADIC_BITS].get_str());
+        }
+        if (batch_size < 1 || batch_size > QUERY_MAX_BATCH_SIZE) {
+            throw std::runtime_error("unsupported batch size " + query_header[QUERY_BATCH_SIZE].get_str());
+        }
+        if (mpz_sgn(query_header[QUERY_MODULUS].get_mpz_t()) <= 0 ||
+            mpz_size(query_header[QUERY_MODULUS].get_mpz_t()) > WIRE_MAX_WIDTH) {
+            throw std::runtime_error("invalid public modulus");
+        }
+        const Modulus pk_N(query_header[QUERY_MODULUS]); // Extract public modulus N.
+        const size_t width = pk_N.width();               // Limbs per ciphertext.
+
+        // The reply header goes out before the first query is evaluated.
+        writer.write(mpz_class(server_number));
+        writer.write(mpz_class(lc_length));
+        writer.write(mpz_class(batch_size));
+
+        // The two E(0)s are shared by the batch. Blinded zeros r1*E(0) + r2*E(0) are
+        // drawn from two tables of multiples, so each costs one modular addition
+        // instead of a division.
+        CiphertextVector zeros(QUERY_HEADER_SIZE - QUERY_E0_1, width);
+        reader.read_fixed_exact(zeros.data(), zeros.size(), width);
+        CiphertextVector E_0_1_multiples = multiples(zeros[0], pk_N);
+        CiphertextVector E_0_2_multiples = multiples(zeros[1], pk_N);
+
+        // Each query's filters go into one arena, BFx then BFy, reused across the batch.
+        const size_t m = static_cast<size_t>(geometry.size);
+        CiphertextVector filters(2 * m, width);
+        CiphertextVector lc_sketch(lc_length, width);
+        CiphertextAccumulator bucket_sum(1, width);
+        std::shared_ptr<const SketchGroups> groups = sketch_groups(geometry.hash_scheme);
+
+        auto batch_start_time = std::chrono::high_resolution_clock::now();
+        std::chrono::duration<double> eval_elapsed(0);
+        for (long query = 0; query < batch_size; query++) {
+            // --- Step 4: Homomorphic Range Evaluation ---
+            // For each data point, homomorphically check if it's in the query range.
+            // Membership is computed once per distinct coordinate, then the records are
+            // split across the worker pool; sign_list keeps record order.
+            auto start_time = std::chrono::high_resolution_clock::now();
+            reader.read_fixed_exact(filters[0], m, width);
+
+            // BFx is complete: evaluate it while BFy is still in flight.
+            std::future<CiphertextVector> x_products = std::async(std::launch::async, [&]() {
+                return evaluator.x_membership(filters[0], geometry, pk_N, dyadic_bits);
+            });
+            reader.read_fixed_exact(filters[m], m, width);
+            CiphertextVector y_products = evaluator.y_membership(filters[m], geometry, pk_N, dyadic_bits);
+            CiphertextVector sign_list = evaluator.combine(x_products.get(), y_products, pk_N);
+            eval_elapsed += std::chrono::high_resolution_clock::now() - start_time;
+
+            // --- Step 5: Generate Encrypted Linear Counting Sketches ---
+            // The reply holds one sketch per simulated provider for every query.
+            for (int p = 0; p < server_number; p++) {
+                // Initialize this provider's sketch with random noise using E(0).
+                for (int i = 0; i < lc_length; i++) {
+                    // E(r1*0 + r2*0) = E(0), but blinded.
+                    lc_sketch.set(i, E_0_1_multiples[generateRandomNumber(1, max_noise_factor) - 1]);
+                    lc_sketch.add_mod(i, E_0_2_multiples[generateRandomNumber(1, max_noise_factor) - 1], pk_N);
+                }
+
+                // Only the buckets that hold one of this provider's records change. The
+                // records of a bucket are summed in a wide accumulator and the sum is
+                // reduced once.
+                for (int g = groups->provider_begin[p]; g < groups->provider_begin[p + 1]; g++) {
+                    const int lc_index = groups->buckets[g];
+                    bucket_sum.set(0, lc_sketch[lc_index]);
+                    for (int r = groups->offsets[g]; r < groups->offsets[g + 1]; r++) {
+                        // Homomorphically add the sign (E(1) or E(0)) to the bucket.
+                        // E(s) + E(val) = E(s + val). Reducing mod N keeps decryption
+                        // unchanged since p divides N, so it is left until the end.
+                        bucket_sum.add(0, sign_list[groups->records[r]], pk_N);
+                    }
+                    bucket_sum.store(0, lc_sketch[lc_index], pk_N);
+                }
+
+                // The sketch is complete: send the arena as is before the next one is built.
+                writer.write_limbs(lc_sketch.data(), lc_sketch.size(), width);
+            }
+        }
+        if (reader.read_chunk(query_header) != 0) {
+            throw std::runtime_error("query is longer than the announced batch");
+        }
+        writer.finish();
+
+        std::chrono::duration<double> batch_elapsed = std::chrono::high_resolution_clock::now() - batch_start_time;
+        std::cout << "Range evaluation of " << batch_size << (batch_size == 1 ? " query" : " queries") << " over "
+                  << evaluator.size() << " records (m = " << geometry.size << ", k = " << geometry.hash_count
+                  << (geometry.blocked ? ", blocked" : "")
+                  << (dyadic_bits > 0 ? ", dyadic D = " + std::to_string(dyadic_bits) : std::string()) << ") with " << evaluator.worker_count()
+                  << " workers: " << eval_elapsed.count() << " s (" << batch_elapsed.count() << " s with sketches)\n";
+    }
 
-    std::vector<mpz_class> numbers;
-    size_t offset = 0;
+    /// The largest Bloom filter size a query may announce.
+    static const int max_filter_size = 1 << 24;
+
+    /// The largest random factor of each E(0) in a blinded zero.
+    static const int max_noise_factor = 100;
+
+    /// The total number of records held.
+    int size() const { return evaluator.size(); }
+
+    /// The range evaluator, for reporting.
+    const RangeEvaluator &range_evaluator() const { return evaluator; }
+
+private:
+    /**
+     * @struct SketchGroups
+     * @brief  Every provider's records grouped by sketch bucket under one hash scheme.
+     * @note   Group g is bucket buckets[g]; its records are
+     *         records[offsets[g]], ..., records[offsets[g + 1] - 1]. The groups of
+     *         provider p are provider_begin[p], ..., provider_begin[p + 1] - 1, and
+     *         buckets no record falls into have no group.
+     */
+    struct SketchGroups {
+        std::vector<int> provider_begin; ///< server_number + 1 group positions.
+        std::vector<int> buckets;        ///< The bucket of each group.
+        std::vector<int> offsets;        ///< The first record of each group, plus an end marker.
+        std::vector<int> records;        ///< Record indices, grouped.
+    };
+
+    /**
+     * @brief  Returns the records grouped by sketch bucket under a hash scheme.
+     * @note   The buckets only depend on the data, so they are computed on the
+     *         first query that uses the scheme and kept for later ones.
+     */
+    std::shared_ptr<const SketchGroups> sketch_groups(int scheme) const {
+        std::lock_guard<std::mutex> lock(sketch_mutex);
+        auto it = sketch_slots.find(scheme);
+        if (it != sketch_slots.end()) {
+            return it->second;
+        }
+        auto groups = std::make_shared<SketchGroups>();
+        groups->offsets.push_back(0);
+        std::vector<int> bucket_size(lc_length);
+        std::vector<int> bucket_records;
+        for (int p = 0; p < server_number; p++) {
+            groups->provider_begin.push_back(static_cast<int>(groups->buckets.size()));
+            const int first = static_cast<int>(data.provider_begin(p));
+            const int count = static_cast<int>(data.provider_begin(p + 1)) - first;
+
+            // A counting sort of the provider's records by bucket.
+            std::vector<int> record_bucket(count);
+            std::fill(bucket_size.begin(), bucket_size.end(), 0);
+            for (int i = 0; i < count; i++) {
+                // The sketch uses the query's hash scheme so all data holders agree on buckets.
+                record_bucket[i] = sketch_index(scheme, data.x()[first + i], data.y()[first + i], lc_length, 0);
+                bucket_size[record_bucket[i]]++;
+            }
+            std::vector<int> bucket_start(lc_length + 1, 0);
+            for (int b = 0; b < lc_length; b++) {
+                bucket_start[b + 1] = bucket_start[b] + bucket_size[b];
+                if (bucket_size[b] > 0) {
+                    groups->buckets.push_back(b);
+                    groups->offsets.push_back(static_cast<int>(groups->records.size()) + bucket_start[b + 1]);
+                }
+            }
+            bucket_records.resize(count);
+            for (int i = 0; i < count; i++) {
+                bucket_records[bucket_start[record_bucket[i]]++] = first + i;
+            }
+            groups->records.insert(groups->records.end(), bucket_records.begin(), bucket_records.end());
+        }
+        groups->provider_begin.push_back(static_cast<int>(groups->buckets.size()));
+        sketch_slots[scheme] = groups;
+        return groups;
+    }
 
-    while (offset < buffer.size()) {
-        uint32_t len;
-        std::memcpy(&len, buffer.data() + offset, sizeof(len));
-        offset += sizeof(len);
+    /**
+     * @brief  Returns r * c mod N for r = 1, ..., max_noise_factor, in that order.
+     */
+    static CiphertextVector multiples(const mp_limb_t *c, const Modulus &modulus) {
+        CiphertextVector table(max_noise_factor, modulus.width());
+        table.set(0, c);
+        for (int r = 1; r < max_noise_factor; r++) {
+            table.set(r, table[r - 1]);
+            table.add_mod(r, c, modulus);
+        }
+        return table;
+    }
 
-        mpz_class num;
-        mpz_import(num.get_mpz_t(), len, 1, 1, 1, 0, buffer.data() + offset);
-        offset += len;
+    Dataset data;
+    int server_number;
+    int lc_length;
+    RangeEvaluator evaluator;
 
-        numbers.emplace_back(std::move(num));
-    }
+    mutable std::mutex sketch_mutex;
+    mutable std::map<int, std::shared_ptr<const SketchGroups>> sketch_slots;
+};
 
-    return numbers;
-}
 
 /**
- * @brief  Computes a hash in the bloom filter.
+ * @brief  Answers queries on one connection until the peer closes it.
+ * @param  socket  The connected socket.
+ * @param  holder  The shared data holder state.
+ * @param  id      A number identifying the session in the log.
  */
-int hashr(int data, int length, int seed) {
-    uint32_t hash_result;
-    std::string key = std::to_string(data) + "|" + std::to_string(length);
-    MurmurHash3_x86_32(key.c_str(), key.size(), seed, &hash_result);
-    return hash_result % length;
+void serve_connection(tcp::socket &socket, const DataHolder &holder, int id) {
+    int queries = 0;
+    try {
+        for (;;) {
+            // --- Step 3: Receive Encrypted data from the Central Aggregator ---
+            // The query is consumed chunk by chunk inside answer().
+            MpzStreamReader reader(socket);
+            MpzStreamWriter writer(socket);
+            try {
+                holder.answer(reader, writer);
+            } catch (boost::system::system_error &e) {
+                // A clean close between queries ends the session.
+                if (e.code() == boost::asio::error::eof && reader.chunks_read() == 0) {
+                    break;
+                }
+                throw;
+            }
+            queries++;
+        }
+    } catch (std::exception &e) {
+        std::cerr << "Session " << id << ": " << e.what() << std::endl;
+    }
+    std::cout << "Session " << id << " closed after " << queries << " queries.\n";
 }
 
-/**
- * @brief  Computes a hash in the linear counting sketch.
- */
-int hasht(int data_1, int data_2, int length, int seed) {
-    uint32_t hash_result;
-    std::string key = std::to_string(data_1) + "|" + std::to_string(data_2) + "|" + std::to_string(length);
-    MurmurHash3_x86_32(key.c_str(), key.size(), seed, &hash_result);
-    return hash_result % length;
-}
 
 /**
- * @brief  Generates a random integer within a specified range.
+ * @class SessionPool
+ * @brief A fixed number of session threads that serve accepted connections in turn.
+ *
+ * Each query is evaluated on the data holder's own worker pool, so bounding the
+ * sessions bounds the threads in use at sessions x workers however many centers
+ * connect. Connections accepted while every session is busy wait in a queue and
+ * are served in arrival order.
  */
-int generateRandomNumber(int lowerBound, int upperBound) {
-    static std::mt19937 gen(std::chrono::steady_clock::now().time_since_epoch().count());
-    std::uniform_int_distribution<> RandomNumber(lowerBound, upperBound);
-    return RandomNumber(gen);
-}
+class SessionPool {
+public:
+    /**
+     * @brief  Starts the session threads.
+     * @param  holder    The shared data holder state; it must outlive the pool.
+     * @param  sessions  The number of connections served concurrently.
+     */
+    SessionPool(const DataHolder &holder, int sessions) : holder(holder) {
+        for (int i = 0; i < sessions; i++) {
+            threads.emplace_back([this]() { run(); });
+        }
+    }
+
+    ~SessionPool() { stop(); }
+
+    SessionPool(const SessionPool &) = delete;
+    SessionPool &operator=(const SessionPool &) = delete;
+
+    /**
+     * @brief  Queues an accepted connection for the next free session.
+     */
+    void submit(tcp::socket socket, int id) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (stopping) {
+            return;
+        }
+        pending.push_back(Connection{std::move(socket), id});
+        ready.notify_one();
+    }
+
+    /**
+     * @brief  Ends every session and joins the session threads.
+     * @note   Queued connections are closed unanswered. Connections being served are
+     *         shut down at the descriptor level, which ends the blocking read their
+     *         session is waiting in.
+     */
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+            pending.clear();
+            for (tcp::socket *socket : active) {
+                // The socket object is in use by its session thread, so only the
+                // descriptor is touched: ::shutdown() is safe across threads.
+                ::shutdown(socket->native_handle(), SHUT_RDWR);
+            }
+        }
+        ready.notify_all();
+        for (std::thread &thread : threads) {
+            if (thread.joinable()) {
+                thread.join();
+            }
+        }
+    }
+
+private:
+    /**
+     * @struct Connection
+     * @brief  An accepted connection waiting for a session.
+     */
+    struct Connection {
+        tcp::socket socket;
+        int id;
+    };
+
+    /**
+     * @brief  The loop of one session thread: serve queued connections until stopped.
+     */
+    void run() {
+        for (;;) {
+            std::unique_lock<std::mutex> lock(mutex);
+            ready.wait(lock, [this]() { return stopping || !pending.empty(); });
+            if (stopping) {
+                return;
+            }
+            Connection connection = std::move(pending.front());
+            pending.pop_front();
+            active.insert(&connection.socket);
+            lock.unlock();
+
+            serve_connection(connection.socket, holder, connection.id);
+
+            lock.lock();
+            active.erase(&connection.socket);
+        }
+    }
+
+    const DataHolder &holder;
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::deque<Connection> pending;
+    std::set<tcp::socket *> active; ///< The sockets being served, for stop().
+    bool stopping = false;
+};
 
 
 /**
  * @brief  Main entry point for the Data Holder server application.
+ * @note   The server loads its data once and then runs until SIGINT or SIGTERM.
+ *         Accepted connections are served by a bounded pool of sessions, and each
+ *         may carry any number of sequential queries.
  */
 int main(int argc, char *argv[]) {
-    if (argc != 2) {
-        std::cerr << "Usage: " << argv[0] << " <listen_port>\n";
+    // --- Argument Parsing ---
+    // <listen_port> is optionally followed by the worker count, --sessions <count>, and
+    // either --dataset <file> or --csv <file> [--providers <count>] [--fraction <f>] [--seed <s>].
+    std::vector<std::string> args(argv + 1, argv + argc);
+    std::vector<std::string> positional;
+    std::string dataset_path, csv_path;
+    int csv_providers = 4;
+    double csv_fraction = 0; // 0: contiguous partitions instead of sampling.
+    uint64_t csv_seed = 0;
+    int sessions = 0; // 0: as many as the hardware threads allow at `workers` each.
+    bool usage_error = false;
+    try {
+        for (size_t i = 0; i < args.size() && !usage_error; i++) {
+            if (args[i] == "--dataset" && i + 1 < args.size()) {
+                dataset_path = args[++i];
+            } else if (args[i] == "--csv" && i + 1 < args.size()) {
+                csv_path = args[++i];
+            } else if (args[i] == "--providers" && i + 1 < args.size()) {
+                csv_providers = std::stoi(args[++i]);
+            } else if (args[i] == "--fraction" && i + 1 < args.size()) {
+                csv_fraction = std::stod(args[++i]);
+            } else if (args[i] == "--seed" && i + 1 < args.size()) {
+                csv_seed = std::stoull(args[++i]);
+            } else if (args[i] == "--sessions" && i + 1 < args.size()) {
+                sessions = std::stoi(args[++i]);
+                usage_error = sessions < 1;
+            } else if (args[i].rfind("--", 0) == 0) {
+                usage_error = true;
+            } else {
+                positional.push_back(args[i]);
+            }
+        }
+    } catch (std::logic_error &) {
+        // A malformed number is a usage error rather than an uncaught exception.
+        usage_error = true;
+    }
+    std::string listen_port;
+    // The number of threads used for the homomorphic range evaluation of each query.
+    int workers = default_worker_count();
+    if (!usage_error && !positional.empty() && positional.size() <= 2) {
+        try {
+            listen_port = positional[0];
+            const int port_number = std::stoi(listen_port);
+            if (positional.size() == 2) {
+                workers = std::stoi(positional[1]);
+            }
+            usage_error = port_number < 1 || port_number > 65535 || workers < 1;
+        } catch (std::logic_error &) {
+            usage_error = true;
+        }
+    }
+    if (usage_error || positional.empty() || positional.size() > 2 || (!dataset_path.empty() && !csv_path.empty()) ||
+        csv_providers < 1 || csv_fraction < 0 || csv_fraction > 1) {
+        std::cerr << "Usage: " << argv[0] << " <listen_port> [workers] [--sessions <count>] [--dataset <file> | --csv <file>"
+                  << " [--providers <count>] [--fraction <f>] [--seed <s>]]\n";
         return 1;
     }
-    std::string listen_port = argv[1];
+    if (sessions == 0) {
+        sessions = std::max(1, default_worker_count() / workers);
+    }
 
     try {
         boost::asio::io_context io_context;
 
-        // --- Step 1: Network Setup ---
-        // Listen for an incoming connection from the central server.
-        tcp::acceptor acceptor(io_context, tcp::endpoint(tcp::v4(), std::stoi(listen_port)));
-        std::cout << "Data Holder server listening on port " << listen_port << "...\n";
-        tcp::socket socket(io_context);
-        acceptor.accept(socket);
-        std::cout << "Center server connected.\n";
-
         // --- Protocol Parameters ---
-        const int hash_count = 7;       // Number of hash functions for the Bloom filter.
         const int lc_length = 2 * 1024;   // Size of the Linear Counting sketch per provider.
-        const int server_number = 4;     // The number of data holders this server will simulate.
-        const int data_size_per_provider = int(21900 * 0.1); // Size of each provider's dataset.
-        const int total_data_size = data_size_per_provider * server_number;
-
-        // --- Step 2: Simulate Local Data Generation ---
-        // In a real scenario, this data would be loaded from a database or file.
-        // Here, we generate synthetic data for simulation purposes.
-        auto start_time = std::chrono::high_resolution_clock::now();
-        std::vector<int> arr1(total_data_size), arr2(total_data_size);
-        for (int p = 0; p < server_number; ++p) {
-            for (int i = 0; i < data_size_per_provider; ++i) {
-                int index = p * data_size_per_provider + i;
-                arr1[index] = i + p; // Simple non-overlapping data.
-                arr2[index] = i + p;
-            }
-        }
-        auto end_time = std::chrono::high_resolution_clock::now();
-        
-        // --- Step 3: Receive Encrypted data from the Central Aggregator ---
-        // The received vector contains: [Encrypted BFx][Encrypted BFy][E(0)][E(0)][N]
-        std::vector<mpz_class> query_from_client = receive_multiple_mpz_class(socket);
-        const int bf_length = (query_from_client.size() - 3) / 2;
-        std::cout << "Received encrypted query Bloom filter." << std::endl;
-
-        // --- Step 4: Homomorphic Range Evaluation ---
-        // For each data point, homomorphically check if it's in the query range.
-        std::vector<mpz_class> sign_list;
-        sign_list.reserve(total_data_size);
-        mpz_class pk_N = query_from_client.back(); // Extract public modulus N.
-
-        for (int i = 0; i < total_data_size; i++) {
-            mpz_class sign_1 = 1; // E(1) is 1 in this scheme
-            mpz_class sign_2 = 1;
-            
-            // Homomorphically check against the Bloom filters.
-            // This is equivalent to an AND operation in the plaintext domain.
-            for (int j = 0; j < hash_count; j++) {
-                int index1 = hashr(arr1[i], bf_length, j);
-                int index2 = hashr(arr2[i], bf_length, j);
-                // Homomorphic multiplication: E(a) * E(b) = E(a*b).
-                // If any bf_from_client[index] is E(0), the product becomes E(0).
-                sign_1 = (sign_1 * query_from_client[index1]) % pk_N;
-                sign_2 = (sign_2 * query_from_client[index2 + bf_length]) % pk_N;
-            }
-            // Final check: if both dimensions are in range, result is E(1), otherwise E(0).
-            sign_list.push_back(sign_1 * sign_2);
-        }
-        
-        // --- Step 5: Generate Encrypted Linear Counting Sketches ---
-        // The final result is a concatenation of sketches from all simulated providers.
-        std::vector<mpz_class> lc_sketch_combined(lc_length * server_number);
-        const mpz_class E_0_1 = query_from_client[query_from_client.size() - 3];
-        const mpz_class E_0_2 = query_from_client[query_from_client.size() - 2];
 
-        // For each simulated provider...
-        for (int p = 0; p < server_number; p++) {
-            // Initialize this provider's sketch with random noise using E(0).
-            for (int i = 0; i < lc_length; i++) {
-                // E(r1*0 + r2*0) = E(0), but blinded.
-                lc_sketch_combined[i + p * lc_length] = (generateRandomNumber(1, 100) * E_0_1) + (generateRandomNumber(1, 100) * E_0_2);
-            }
-
-            // For each data point belonging to this provider...
-            for (int i = 0; i < data_size_per_provider; i++) {
-                int data_index = p * data_size_per_provider + i;
-                int lc_index = hasht(arr1[data_index], arr2[data_index], lc_length, 0);
-                
-                // Homomorphically add the sign (E(1) or E(0)) to the corresponding sketch bucket.
-                // E(s) + E(val) = E(s + val).
-                lc_sketch_combined[lc_index + p * lc_length] += sign_list[data_index];
+        // --- Step 1: Load or Simulate Local Data ---
+        // A dataset file (see convert_dataset) is mapped as is; its partitions are the
+        // simulated providers. A CSV is parsed in parallel and either split into
+        // providers or, with --fraction, sampled by each provider independently.
+        // Without either, synthetic data is generated.
+        Dataset data;
+        auto load_start_time = std::chrono::high_resolution_clock::now();
+        if (!dataset_path.empty()) {
+            data = Dataset::map(dataset_path);
+        } else if (!csv_path.empty()) {
+            data = (csv_fraction > 0)
+                ? Dataset::sample(Dataset::read_csv(csv_path, 1, workers), csv_providers, csv_fraction, csv_seed, workers)
+                : Dataset::read_csv(csv_path, csv_providers, workers);
+        } else {
+            const int server_number = 4;     // The number of data holders this server will simulate.
+            const int data_size_per_provider = int(21900 * 0.1); // Size of each provider's dataset.
+            const int total_data_size = data_size_per_provider * server_number;
+            std::vector<int32_t> arr1(total_data_size), arr2(total_data_size);
+            std::vector<uint64_t> provider_begin(server_number + 1);
+            for (int p = 0; p < server_number; ++p) {
+                provider_begin[p] = static_cast<uint64_t>(p) * data_size_per_provider;
+                for (int i = 0; i < data_size_per_provider; ++i) {
+                    int index = p * data_size_per_provider + i;
+                    arr1[index] = i + p; // Simple non-overlapping data.
+                    arr2[index] = i + p;
+                }
             }
+            provider_begin[server_number] = total_data_size;
+            data = Dataset::from_columns(std::move(arr1), std::move(arr2), std::move(provider_begin));
         }
-        
-        // --- Send LC Sketches Back ---
-        send_multiple_mpz_class(socket, lc_sketch_combined);
-        std::cout << "Sent encrypted sketches back to the center server.\n";
+        std::chrono::duration<double> load_elapsed = std::chrono::high_resolution_clock::now() - load_start_time;
+        std::cout << (data.mapped() ? "Mapped " + dataset_path
+                      : !csv_path.empty() ? "Parsed " + csv_path : std::string("Generated synthetic data"))
+                  << " in " << load_elapsed.count() << " s.\n";
+
+        const int server_number = data.providers();
+        DataHolder holder(std::move(data), lc_length, workers);
+        std::cout << "Loaded " << holder.size() << " records for " << server_number << " providers ("
+                  << holder.range_evaluator().distinct_x() << " distinct x, "
+                  << holder.range_evaluator().distinct_y() << " distinct y, "
+                  << holder.range_evaluator().distinct_cells() << " distinct points).\n";
+
+        // --- Step 2: Network Setup ---
+        // Connections from central servers are accepted asynchronously on the io_context
+        // and handed to the session pool, until SIGINT or SIGTERM stops the server. A
+        // failed accept (e.g. out of file descriptors) is logged and retried shortly.
+        SessionPool pool(holder, sessions);
+        tcp::acceptor acceptor(io_context, tcp::endpoint(tcp::v4(), std::stoi(listen_port)));
+        boost::asio::steady_timer retry_timer(io_context);
+        int session = 0;
+        std::function<void()> accept_next = [&]() {
+            acceptor.async_accept([&](const boost::system::error_code &ec, tcp::socket socket) {
+                if (ec == boost::asio::error::operation_aborted) {
+                    return;
+                }
+                if (ec) {
+                    std::cerr << "Accept failed: " << ec.message() << std::endl;
+                    retry_timer.expires_after(std::chrono::milliseconds(100));
+                    retry_timer.async_wait([&](const boost::system::error_code &ec) {
+                        if (!ec) {
+                            accept_next();
+                        }
+                    });
+                    return;
+                }
+                session++;
+                std::cout << "Center server connected (session " << session << ").\n";
+                pool.submit(std::move(socket), session);
+                accept_next();
+            });
+        };
+        boost::asio::signal_set signals(io_context, SIGINT, SIGTERM);
+        signals.async_wait([&](const boost::system::error_code &, int) {
+            boost::system::error_code ignored;
+            acceptor.close(ignored);
+            retry_timer.cancel();
+        });
+        std::cout << "Data Holder server listening on port " << listen_port << " with " << sessions
+                  << (sessions == 1 ? " session" : " concurrent sessions") << "...\n";
+        accept_next();
+        io_context.run();
+
+        // Every session is joined before the data holder state goes away.
+        pool.stop();
+        std::cout << "Data Holder server stopped after " << session << " sessions.\n";
 
     } catch (std::exception &e) {
         std::cerr << "Exception: " << e.what() << std::endl;
@@ -228,4 +623,3 @@ int main(int argc, char *argv[]) {
 
     return 0;
 }
-
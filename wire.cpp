@@ -0,0 +1,462 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  wire.cpp
+ *
+ *    Description:  Implementation of the chunked wire protocol.
+ *
+ *        Version:  1.0
+ *
+ * =====================================================================================
+ */
+
+#include "wire.h"
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <string>
+#include <stdexcept>
+
+using boost::asio::ip::tcp;
+
+/**
+ * @brief  Appends the encoding of one number to a chunk payload.
+ * @param  payload  The payload being built.
+ * @param  number   The number to encode.
+ */
+void wire_encode_element(std::vector<uint8_t> &payload, const mpz_class &number) {
+    // Export straight into the payload instead of a temporary malloc'ed buffer.
+    size_t bytes = (mpz_sizeinbase(number.get_mpz_t(), 2) + 7) / 8;
+    size_t offset = payload.size();
+    payload.resize(offset + sizeof(uint32_t) + bytes);
+
+    size_t count = 0;
+    mpz_export(payload.data() + offset + sizeof(uint32_t), &count, 1, 1, 1, 0, number.get_mpz_t());
+
+    // mpz_export writes nothing for zero, so the real length may be shorter.
+    uint32_t len = static_cast<uint32_t>(count);
+    std::memcpy(payload.data() + offset, &len, sizeof(len));
+    payload.resize(offset + sizeof(uint32_t) + count);
+}
+
+/**
+ * @brief  Copies one number into a fixed-width slot of `width` limbs.
+ */
+void wire_store_limbs(mp_limb_t *slot, const mpz_class &number, size_t width) {
+    const size_t size = mpz_size(number.get_mpz_t());
+    if (mpz_sgn(number.get_mpz_t()) < 0 || size > width) {
+        throw std::invalid_argument("number does not fit a fixed-width element of " + std::to_string(width) + " limbs");
+    }
+    std::memcpy(slot, mpz_limbs_read(number.get_mpz_t()), size * sizeof(mp_limb_t));
+    std::fill(slot + size, slot + width, 0);
+}
+
+/**
+ * @brief  Decodes a chunk payload and appends its elements to a vector.
+ * @param  payload  The payload bytes.
+ * @param  header   The header of the chunk.
+ * @param  numbers  Output: the decoded elements are appended here.
+ */
+void wire_decode_chunk(const uint8_t *payload, const WireChunkHeader &header, std::vector<mpz_class> &numbers) {
+    numbers.reserve(numbers.size() + header.count);
+
+    if (header.width != 0) {
+        // The limbs are copied into each number's own storage in one pass.
+        const size_t width = header.width;
+        for (uint64_t i = 0; i < header.count; i++) {
+            mpz_class num;
+            mp_limb_t *limbs = mpz_limbs_write(num.get_mpz_t(), width);
+            std::memcpy(limbs, payload + i * width * sizeof(mp_limb_t), width * sizeof(mp_limb_t));
+            mp_size_t size = width;
+            while (size > 0 && limbs[size - 1] == 0) {
+                size--;
+            }
+            mpz_limbs_finish(num.get_mpz_t(), size);
+            numbers.emplace_back(std::move(num));
+        }
+        return;
+    }
+
+    const size_t length = header.length;
+    size_t offset = 0;
+    for (uint64_t i = 0; i < header.count; i++) {
+        uint32_t len;
+        if (length - offset < sizeof(len)) {
+            throw std::runtime_error("truncated chunk");
+        }
+        std::memcpy(&len, payload + offset, sizeof(len));
+        offset += sizeof(len);
+        if (length - offset < len) {
+            throw std::runtime_error("truncated chunk");
+        }
+
+        mpz_class num;
+        mpz_import(num.get_mpz_t(), len, 1, 1, 1, 0, payload + offset);
+        offset += len;
+
+        numbers.emplace_back(std::move(num));
+    }
+
+    if (offset != length) {
+        throw std::runtime_error("chunk length does not match its elements");
+    }
+}
+
+/**
+ * @brief  Makes read-only mpz views of fixed-width elements without copying them.
+ * @param  limbs  The elements, `width` limbs each.
+ * @param  count  The number of elements.
+ * @param  width  The limbs per element.
+ * @param  views  Output: `count` views.
+ */
+void wire_limb_views(const mp_limb_t *limbs, size_t count, size_t width, __mpz_struct *views) {
+    for (size_t i = 0; i < count; i++) {
+        // mpz_roinit_n strips the zero padding, so each view has its true size.
+        mpz_roinit_n(&views[i], limbs + i * width, static_cast<mp_size_t>(width));
+    }
+}
+
+/**
+ * @brief  Returns the number of limbs of the widest number in a range.
+ */
+size_t wire_max_width(const mpz_class *numbers, size_t count) {
+    size_t width = 1;
+    for (size_t i = 0; i < count; i++) {
+        width = std::max(width, mpz_size(numbers[i].get_mpz_t()));
+    }
+    return width;
+}
+
+/**
+ * @brief  Checks a received chunk header against the reader's limits.
+ */
+void wire_check_header(const WireChunkHeader &header) {
+    if (header.length > WIRE_MAX_CHUNK_BYTES) {
+        throw std::runtime_error("chunk of " + std::to_string(header.length) + " bytes exceeds the limit");
+    }
+    if (header.width == 0) {
+        // Every element takes at least its 4-byte length.
+        if (header.count > header.length / sizeof(uint32_t)) {
+            throw std::runtime_error("chunk announces more elements than it can hold");
+        }
+    } else if (header.width > WIRE_MAX_WIDTH || header.count > header.length ||
+               header.length != header.count * header.width * sizeof(mp_limb_t)) {
+        throw std::runtime_error("fixed-width chunk length does not match its elements");
+    }
+}
+
+/**
+ * @brief  Appends one chunk (header and payload) to a message buffer.
+ */
+static void append_chunk(std::vector<uint8_t> &message, uint64_t count, const std::vector<uint8_t> &payload) {
+    WireChunkHeader header = { count, payload.size(), 0 };
+    const uint8_t *header_ptr = reinterpret_cast<const uint8_t *>(&header);
+    message.insert(message.end(), header_ptr, header_ptr + sizeof(header));
+    message.insert(message.end(), payload.begin(), payload.end());
+}
+
+/**
+ * @brief  Encodes a whole vector as one message in memory.
+ * @param  numbers         The numbers to encode.
+ * @param  chunk_elements  The number of elements per chunk.
+ * @return The message bytes, end chunk included.
+ */
+std::vector<uint8_t> wire_encode_message(const std::vector<mpz_class> &numbers, size_t chunk_elements) {
+    std::vector<uint8_t> message;
+    // Estimated average size of 520 bytes per number.
+    message.reserve(numbers.size() * 520 + sizeof(WireChunkHeader));
+
+    std::vector<uint8_t> payload;
+    for (size_t begin = 0; begin < numbers.size(); begin += chunk_elements) {
+        size_t end = std::min(numbers.size(), begin + chunk_elements);
+        payload.clear();
+        for (size_t i = begin; i < end; i++) {
+            wire_encode_element(payload, numbers[i]);
+        }
+        append_chunk(message, end - begin, payload);
+    }
+    append_chunk(message, 0, std::vector<uint8_t>());
+    return message;
+}
+
+/**
+ * @brief  Starts a message on a socket.
+ * @param  socket          The active Boost.Asio TCP socket.
+ * @param  chunk_elements  The number of elements per chunk.
+ */
+MpzStreamWriter::MpzStreamWriter(tcp::socket &socket, size_t chunk_elements)
+    : socket(socket), chunk_elements(std::max<size_t>(1, chunk_elements)) {
+    payload.reserve(this->chunk_elements * 520);
+}
+
+/**
+ * @brief  Appends one number to the message, writing the chunk once it is full.
+ */
+void MpzStreamWriter::write(const mpz_class &number) {
+    if (pending_width != 0) {
+        flush();
+    }
+    wire_encode_element(payload, number);
+    if (++pending == chunk_elements) {
+        flush();
+    }
+}
+
+/**
+ * @brief  Appends a range of numbers to the message.
+ */
+void MpzStreamWriter::write(const mpz_class *numbers, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        write(numbers[i]);
+    }
+}
+
+/**
+ * @brief  Appends one non-negative number as a fixed-width element of `width` limbs.
+ */
+void MpzStreamWriter::write_fixed(const mpz_class &number, size_t width) {
+    if (pending != 0 && pending_width != width) {
+        flush();
+    }
+    pending_width = width;
+    // A fixed-width chunk holds nothing but whole limbs, so every slot is limb-aligned.
+    size_t offset = payload.size();
+    payload.resize(offset + width * sizeof(mp_limb_t));
+    wire_store_limbs(reinterpret_cast<mp_limb_t *>(payload.data() + offset), number, width);
+    if (++pending == chunk_elements) {
+        flush();
+    }
+}
+
+/**
+ * @brief  Appends a range of non-negative numbers as fixed-width elements.
+ */
+void MpzStreamWriter::write_fixed(const mpz_class *numbers, size_t count, size_t width) {
+    flush();
+    // Shorter numbers are padded from one shared run of zero limbs.
+    const std::vector<mp_limb_t> zeros(width, 0);
+    std::vector<boost::asio::const_buffer> buffers;
+    buffers.reserve(2 * chunk_elements + 1);
+
+    for (size_t begin = 0; begin < count; begin += chunk_elements) {
+        const size_t end = std::min(count, begin + chunk_elements);
+        WireChunkHeader header = { end - begin, (end - begin) * width * sizeof(mp_limb_t), width };
+        buffers.clear();
+        buffers.push_back(boost::asio::buffer(&header, sizeof(header)));
+        for (size_t i = begin; i < end; i++) {
+            mpz_srcptr number = numbers[i].get_mpz_t();
+            const size_t size = mpz_size(number);
+            if (mpz_sgn(number) < 0 || size > width) {
+                throw std::invalid_argument("number does not fit a fixed-width element of " +
+                                            std::to_string(width) + " limbs");
+            }
+            buffers.push_back(boost::asio::buffer(mpz_limbs_read(number), size * sizeof(mp_limb_t)));
+            if (size < width) {
+                buffers.push_back(boost::asio::buffer(zeros.data(), (width - size) * sizeof(mp_limb_t)));
+            }
+        }
+        boost::asio::write(socket, buffers);
+    }
+}
+
+/**
+ * @brief  Appends `count` fixed-width elements stored contiguously, `width` limbs each.
+ */
+void MpzStreamWriter::write_limbs(const mp_limb_t *limbs, size_t count, size_t width) {
+    flush();
+    for (size_t begin = 0; begin < count; begin += chunk_elements) {
+        const size_t elements = std::min(count - begin, chunk_elements);
+        WireChunkHeader header = { elements, elements * width * sizeof(mp_limb_t), width };
+        std::array<boost::asio::const_buffer, 2> buffers = {
+            boost::asio::buffer(&header, sizeof(header)),
+            boost::asio::buffer(limbs + begin * width, header.length)
+        };
+        boost::asio::write(socket, buffers);
+    }
+}
+
+/**
+ * @brief  Writes the pending chunk, if any, even if it is not full.
+ */
+void MpzStreamWriter::flush() {
+    if (pending == 0) {
+        return;
+    }
+    WireChunkHeader header = { pending, payload.size(), pending_width };
+    // Header and payload go out in one gathered write.
+    std::array<boost::asio::const_buffer, 2> buffers = {
+        boost::asio::buffer(&header, sizeof(header)), boost::asio::buffer(payload)
+    };
+    boost::asio::write(socket, buffers);
+    payload.clear();
+    pending = 0;
+    pending_width = 0;
+}
+
+/**
+ * @brief  Writes the pending chunk and the end chunk.
+ */
+void MpzStreamWriter::finish() {
+    flush();
+    WireChunkHeader end = { 0, 0, 0 };
+    boost::asio::write(socket, boost::asio::buffer(&end, sizeof(end)));
+}
+
+/**
+ * @brief  Prepares to read a message from a socket.
+ * @param  socket  The active Boost.Asio TCP socket.
+ */
+MpzStreamReader::MpzStreamReader(tcp::socket &socket) : socket(socket) {
+}
+
+/**
+ * @brief  Reads and checks the next chunk header.
+ * @return False once the end chunk has been read.
+ */
+bool MpzStreamReader::read_header(WireChunkHeader &header) {
+    if (finished) {
+        return false;
+    }
+    boost::asio::read(socket, boost::asio::buffer(&header, sizeof(header)));
+    chunks++;
+    if (header.count == 0) {
+        if (header.length != 0) {
+            throw std::runtime_error("malformed end chunk");
+        }
+        finished = true;
+        return false;
+    }
+    wire_check_header(header);
+    return true;
+}
+
+/**
+ * @brief  Reads the next chunk and appends its elements to a vector.
+ * @param  numbers  Output: the decoded elements are appended here.
+ * @return The number of elements appended; 0 once the message has ended.
+ */
+size_t MpzStreamReader::read_chunk(std::vector<mpz_class> &numbers) {
+    check_nothing_buffered();
+    WireChunkHeader header;
+    if (!read_header(header)) {
+        return 0;
+    }
+    payload.resize(header.length);
+    boost::asio::read(socket, boost::asio::buffer(payload));
+    wire_decode_chunk(payload.data(), header, numbers);
+    return static_cast<size_t>(header.count);
+}
+
+/**
+ * @brief  Reads chunks until at least `count` elements are in `numbers` or the message ends.
+ * @return Whether `numbers` holds at least `count` elements.
+ */
+bool MpzStreamReader::read_until(std::vector<mpz_class> &numbers, size_t count) {
+    while (numbers.size() < count) {
+        if (read_chunk(numbers) == 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief  Reads the next chunk, which must be fixed-width, straight into limb storage.
+ * @param  out           Where the elements go, `width` limbs each.
+ * @param  max_elements  The number of elements `out` has room for.
+ * @param  width         The expected element width in limbs.
+ * @return The number of elements read; 0 once the message has ended.
+ */
+size_t MpzStreamReader::read_fixed(mp_limb_t *out, size_t max_elements, size_t width) {
+    check_nothing_buffered();
+    WireChunkHeader header;
+    if (!read_header(header)) {
+        return 0;
+    }
+    if (header.width != width) {
+        throw std::runtime_error("expected elements of " + std::to_string(width) + " limbs, got " +
+                                 std::to_string(header.width));
+    }
+    if (header.count > max_elements) {
+        throw std::runtime_error("chunk holds more elements than expected");
+    }
+    // The socket fills the destination limbs directly; no staging copy.
+    boost::asio::read(socket, boost::asio::buffer(out, header.length));
+    return static_cast<size_t>(header.count);
+}
+
+/**
+ * @brief  Reads exactly `count` fixed-width elements into limb storage.
+ */
+void MpzStreamReader::read_fixed_exact(mp_limb_t *out, size_t count, size_t width) {
+    size_t received = 0;
+    // Elements left over from the previous call come first.
+    if (buffered_at < buffered.size()) {
+        if (buffered_width != width) {
+            throw std::runtime_error("expected elements of " + std::to_string(width) + " limbs, got " +
+                                     std::to_string(buffered_width));
+        }
+        received = std::min(count, (buffered.size() - buffered_at) / width);
+        std::memcpy(out, buffered.data() + buffered_at, received * width * sizeof(mp_limb_t));
+        buffered_at += received * width;
+    }
+
+    while (received < count) {
+        WireChunkHeader header;
+        if (!read_header(header)) {
+            throw std::runtime_error("message ended after " + std::to_string(received) + " of " +
+                                     std::to_string(count) + " elements");
+        }
+        if (header.width != width) {
+            throw std::runtime_error("expected elements of " + std::to_string(width) + " limbs, got " +
+                                     std::to_string(header.width));
+        }
+        const size_t n = static_cast<size_t>(header.count);
+        if (n <= count - received) {
+            boost::asio::read(socket, boost::asio::buffer(out + received * width, header.length));
+            received += n;
+            continue;
+        }
+        // The chunk runs past `count`: stage it and keep the tail.
+        buffered.resize(n * width);
+        boost::asio::read(socket, boost::asio::buffer(buffered.data(), header.length));
+        const size_t take = count - received;
+        std::memcpy(out + received * width, buffered.data(), take * width * sizeof(mp_limb_t));
+        buffered_at = take * width;
+        buffered_width = width;
+        received = count;
+    }
+}
+
+/**
+ * @brief  Throws if read_fixed_exact() left elements that another read would skip.
+ */
+void MpzStreamReader::check_nothing_buffered() const {
+    if (buffered_at < buffered.size()) {
+        throw std::runtime_error("unread elements remain in the current chunk");
+    }
+}
+
+/**
+ * @brief  Sends a vector of mpz_class numbers over a TCP socket as one message.
+ * @param  socket   The active Boost.Asio TCP socket.
+ * @param  numbers  A constant reference to the vector of mpz_class to send.
+ */
+void send_multiple_mpz_class(tcp::socket &socket, const std::vector<mpz_class> &numbers) {
+    MpzStreamWriter writer(socket);
+    writer.write(numbers.data(), numbers.size());
+    writer.finish();
+}
+
+/**
+ * @brief  Receives a whole message from a TCP socket.
+ * @param  socket  The active Boost.Asio TCP socket.
+ * @return A vector containing the received mpz_class numbers.
+ */
+std::vector<mpz_class> receive_multiple_mpz_class(tcp::socket &socket) {
+    MpzStreamReader reader(socket);
+    std::vector<mpz_class> numbers;
+    while (reader.read_chunk(numbers) > 0) {
+    }
+    return numbers;
+}
@@ -0,0 +1,315 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  wire.h
+ *
+ *    Description:  Public interface for the wire protocol shared by the query
+ *                  user, the central aggregator and the data holders. Vectors of
+ *                  mpz_class numbers are sent as a stream of chunks, so a sender
+ *                  can write while it is still producing numbers and a receiver
+ *                  can process a chunk while the rest is in flight. Ciphertexts
+ *                  travel as fixed-width limb arrays that are written straight
+ *                  from, and read straight into, GMP limb storage.
+ *
+ *        Version:  1.0
+ *
+ * =====================================================================================
+ */
+
+#ifndef WIRE_H
+#define WIRE_H
+
+#include <boost/asio.hpp>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <gmpxx.h>
+
+/**
+ * @note   Message layout:
+ *         A message is a sequence of chunks followed by an empty end chunk.
+ *         Each chunk is [8-byte element count][8-byte payload length][8-byte width][payload].
+ *         - width == 0 (variable-width chunk, for plaintext parameters): the payload
+ *           holds the elements, each encoded as [4-byte length][big-endian binary data].
+ *         - width > 0 (fixed-width chunk, for ciphertexts): the payload holds count
+ *           elements of exactly `width` 64-bit limbs each, least significant limb first,
+ *           zero-padded. This is the layout of GMP's own limb arrays.
+ *         Lengths, counts and limbs use the host byte order.
+ */
+
+/// The number of elements a writer puts in one chunk by default.
+#define WIRE_CHUNK_ELEMENTS 64
+
+/// The largest chunk payload a reader accepts, to bound its allocation.
+#define WIRE_MAX_CHUNK_BYTES (64ull << 20)
+
+/// The largest element width, in limbs, a reader accepts (a 65536-bit residue).
+#define WIRE_MAX_WIDTH 1024
+
+/// The largest number of range queries a query message may batch.
+#define QUERY_MAX_BATCH_SIZE 4096
+
+static_assert(GMP_NUMB_BITS == 64 && sizeof(mp_limb_t) == 8, "the wire format uses 64-bit limbs without nails");
+
+/**
+ * @enum   QueryField
+ * @brief  The positions of the fields at the front of a query message.
+ * @note   A query is a batch of Q range queries that share one Bloom filter geometry:
+ *         [hash_count][blocked][hash_scheme][D][m][N][Q][E(0)][E(0)][BFx 1][BFy 1]...[BFx Q][BFy Q],
+ *         where the first seven fields are plaintext (variable-width chunks) and each
+ *         encrypted Bloom filter has m entries. D is 0 if the filters hold every
+ *         integer of the ranges, or the domain bits of the dyadic encoding (dyadic.h). The ciphertexts, from the first E(0) on,
+ *         travel in fixed-width chunks of mpz_size(N) limbs. The parameters come first
+ *         so a data holder can set up the evaluation, and start on a BFx, before the
+ *         whole batch has arrived.
+ */
+typedef enum {
+    QUERY_HASH_COUNT = 0,
+    QUERY_BLOCKED,
+    QUERY_HASH_SCHEME,
+    QUERY_DYADIC_BITS, ///< The range encoding: 0 for points, D for dyadic intervals over [0, 2^D).
+    QUERY_FILTER_SIZE,
+    QUERY_MODULUS,
+    QUERY_BATCH_SIZE, ///< The number of range queries Q.
+    QUERY_E0_1,       ///< The first ciphertext; the fields before it are plaintext.
+    QUERY_E0_2,
+    QUERY_HEADER_SIZE ///< The number of fields before the first BFx.
+} QueryField;
+
+/**
+ * @enum   ReplyField
+ * @brief  The positions of the fields at the front of a data holder's reply.
+ * @note   A reply is [P][S][Q] followed by, for each query of the batch in turn, the
+ *         sketches of providers 0, ..., P-1. The plaintext P is the number of
+ *         providers, S the length of each sketch and Q the batch size. The sketches
+ *         are residues mod N and travel in fixed-width chunks.
+ */
+typedef enum {
+    REPLY_PROVIDERS = 0,
+    REPLY_SKETCH_LENGTH,
+    REPLY_BATCH_SIZE,
+    REPLY_HEADER_SIZE ///< The number of fields before the first sketch.
+} ReplyField;
+
+/**
+ * @struct WireChunkHeader
+ * @brief  The fixed-size header in front of every chunk.
+ */
+struct WireChunkHeader {
+    uint64_t count;  ///< The number of elements in the chunk; 0 ends the message.
+    uint64_t length; ///< The size of the payload in bytes.
+    uint64_t width;  ///< The limbs per element, or 0 for variable-width elements.
+};
+
+/**
+ * @brief  Appends the encoding of one number to a chunk payload.
+ * @param  payload  The payload being built.
+ * @param  number   The number to encode.
+ */
+void wire_encode_element(std::vector<uint8_t> &payload, const mpz_class &number);
+
+/**
+ * @brief  Copies one number into a fixed-width slot of `width` limbs.
+ * @throws std::invalid_argument if the number is negative or wider than `width` limbs.
+ */
+void wire_store_limbs(mp_limb_t *slot, const mpz_class &number, size_t width);
+
+/**
+ * @brief  Decodes a chunk payload and appends its elements to a vector.
+ * @param  payload  The payload bytes.
+ * @param  header   The header of the chunk.
+ * @param  numbers  Output: the decoded elements are appended here.
+ * @throws std::runtime_error if the payload does not hold exactly the announced elements.
+ */
+void wire_decode_chunk(const uint8_t *payload, const WireChunkHeader &header, std::vector<mpz_class> &numbers);
+
+/**
+ * @brief  Makes read-only mpz views of fixed-width elements without copying them.
+ * @note   The views alias `limbs` (via mpz_roinit_n) and are only valid while it lives.
+ *         They may be passed anywhere an mpz_srcptr is read, but never written to.
+ * @param  limbs  The elements, `width` limbs each.
+ * @param  count  The number of elements.
+ * @param  width  The limbs per element.
+ * @param  views  Output: `count` views.
+ */
+void wire_limb_views(const mp_limb_t *limbs, size_t count, size_t width, __mpz_struct *views);
+
+/**
+ * @brief  Returns the number of limbs of the widest number in a range.
+ * @note   Numbers must be non-negative to be sent in fixed-width chunks.
+ */
+size_t wire_max_width(const mpz_class *numbers, size_t count);
+
+/**
+ * @brief  Checks a received chunk header against the reader's limits.
+ * @throws std::runtime_error if the header is malformed or the chunk is too large.
+ */
+void wire_check_header(const WireChunkHeader &header);
+
+/**
+ * @brief  Encodes a whole vector as one message in memory.
+ * @note   Useful when the same message is written to several peers.
+ * @param  numbers         The numbers to encode.
+ * @param  chunk_elements  The number of elements per chunk.
+ * @return The message bytes, end chunk included.
+ */
+std::vector<uint8_t> wire_encode_message(const std::vector<mpz_class> &numbers,
+                                         size_t chunk_elements = WIRE_CHUNK_ELEMENTS);
+
+/**
+ * @class MpzStreamWriter
+ * @brief Writes one message to a socket chunk by chunk as numbers are produced.
+ *
+ * Numbers are encoded into a chunk buffer. A full chunk is written right away,
+ * so the peer can start on it while the next one is being produced.
+ */
+class MpzStreamWriter {
+public:
+    /**
+     * @brief  Starts a message on a socket.
+     * @param  socket          The active Boost.Asio TCP socket.
+     * @param  chunk_elements  The number of elements per chunk.
+     */
+    explicit MpzStreamWriter(boost::asio::ip::tcp::socket &socket, size_t chunk_elements = WIRE_CHUNK_ELEMENTS);
+
+    /**
+     * @brief  Appends one number to the message, writing the chunk once it is full.
+     */
+    void write(const mpz_class &number);
+
+    /**
+     * @brief  Appends a range of numbers to the message.
+     */
+    void write(const mpz_class *numbers, size_t count);
+
+    /**
+     * @brief  Appends one non-negative number as a fixed-width element of `width` limbs.
+     * @note   The limbs are copied into the chunk buffer; nothing is allocated per element.
+     */
+    void write_fixed(const mpz_class &number, size_t width);
+
+    /**
+     * @brief  Appends a range of non-negative numbers as fixed-width elements.
+     * @note   The chunks are written with one gathered write straight from the numbers'
+     *         limb storage, without copying them. The numbers must stay unchanged
+     *         until the call returns.
+     */
+    void write_fixed(const mpz_class *numbers, size_t count, size_t width);
+
+    /**
+     * @brief  Appends `count` fixed-width elements stored contiguously, `width` limbs each.
+     * @note   Each chunk is written straight from `limbs` with one gathered write.
+     */
+    void write_limbs(const mp_limb_t *limbs, size_t count, size_t width);
+
+    /**
+     * @brief  Writes the pending chunk, if any, even if it is not full.
+     */
+    void flush();
+
+    /**
+     * @brief  Writes the pending chunk and the end chunk. The writer must not be used afterwards.
+     */
+    void finish();
+
+private:
+    boost::asio::ip::tcp::socket &socket;
+    size_t chunk_elements;
+    size_t pending = 0;
+    size_t pending_width = 0; ///< The width of the pending chunk's elements.
+    std::vector<uint8_t> payload;
+};
+
+/**
+ * @class MpzStreamReader
+ * @brief Reads one message from a socket chunk by chunk.
+ */
+class MpzStreamReader {
+public:
+    /**
+     * @brief  Prepares to read a message from a socket.
+     * @param  socket  The active Boost.Asio TCP socket.
+     */
+    explicit MpzStreamReader(boost::asio::ip::tcp::socket &socket);
+
+    /**
+     * @brief  Reads the next chunk and appends its elements to a vector.
+     * @param  numbers  Output: the decoded elements are appended here.
+     * @return The number of elements appended; 0 once the message has ended.
+     */
+    size_t read_chunk(std::vector<mpz_class> &numbers);
+
+    /**
+     * @brief  Reads chunks until at least `count` elements are in `numbers` or the message ends.
+     * @return Whether `numbers` holds at least `count` elements.
+     */
+    bool read_until(std::vector<mpz_class> &numbers, size_t count);
+
+    /**
+     * @brief  Reads the next chunk, which must be fixed-width, straight into limb storage.
+     * @param  out           Where the elements go, `width` limbs each.
+     * @param  max_elements  The number of elements `out` has room for.
+     * @param  width         The expected element width in limbs.
+     * @return The number of elements read; 0 once the message has ended.
+     * @throws std::runtime_error if the chunk has another width or does not fit.
+     */
+    size_t read_fixed(mp_limb_t *out, size_t max_elements, size_t width);
+
+    /**
+     * @brief  Reads exactly `count` fixed-width elements into limb storage.
+     * @note   Chunks need not end where the caller's fields do. Whole chunks that fit
+     *         are read straight into `out`; the rest of a chunk that runs past `count`
+     *         is kept for the next call.
+     * @param  out    Where the elements go, `width` limbs each.
+     * @param  count  The number of elements wanted.
+     * @param  width  The expected element width in limbs.
+     * @throws std::runtime_error if the message ends early or a chunk has another width.
+     */
+    void read_fixed_exact(mp_limb_t *out, size_t count, size_t width);
+
+    /**
+     * @brief  Returns whether the end chunk has been read.
+     */
+    bool done() const { return finished; }
+
+    /**
+     * @brief  Returns the number of chunks read so far, the end chunk included.
+     */
+    size_t chunks_read() const { return chunks; }
+
+private:
+    /**
+     * @brief  Reads and checks the next chunk header.
+     * @return False once the end chunk has been read.
+     */
+    bool read_header(WireChunkHeader &header);
+
+    /**
+     * @brief  Throws if read_fixed_exact() left elements that another read would skip.
+     */
+    void check_nothing_buffered() const;
+
+    boost::asio::ip::tcp::socket &socket;
+    std::vector<uint8_t> payload;
+    std::vector<mp_limb_t> buffered;    ///< The unread tail of the last fixed-width chunk.
+    size_t buffered_at = 0;             ///< The first unread limb of `buffered`.
+    size_t buffered_width = 0;          ///< The element width of `buffered`.
+    size_t chunks = 0;
+    bool finished = false;
+};
+
+/**
+ * @brief  Sends a vector of mpz_class numbers over a TCP socket as one message.
+ * @param  socket   The active Boost.Asio TCP socket.
+ * @param  numbers  A constant reference to the vector of mpz_class to send.
+ */
+void send_multiple_mpz_class(boost::asio::ip::tcp::socket &socket, const std::vector<mpz_class> &numbers);
+
+/**
+ * @brief  Receives a whole message from a TCP socket.
+ * @param  socket  The active Boost.Asio TCP socket.
+ * @return A vector containing the received mpz_class numbers.
+ */
+std::vector<mpz_class> receive_multiple_mpz_class(boost::asio::ip::tcp::socket &socket);
+
+#endif // WIRE_H